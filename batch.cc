@@ -0,0 +1,247 @@
+// batch warping of panorama images for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "batch.h"
+#include "warp.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+//
+// fixed capacity queue between two pipeline stages; push blocks while it
+// is full, pop blocks while it is empty and fails once it is closed and
+// drained
+//
+template<class T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t n) : capacity(n), closed(false) {}
+
+    void push(const T &item)
+    {
+        unique_lock<mutex> lock(m);
+        while(items.size() >= capacity)
+            notFull.wait(lock);
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+
+    bool pop(T &item)
+    {
+        unique_lock<mutex> lock(m);
+        while(items.empty() && !closed)
+            notEmpty.wait(lock);
+        if(items.empty())
+            return false;
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    deque<T> items;
+    mutex m;
+    condition_variable notEmpty, notFull;
+};
+
+// one image on its way through the pipeline
+struct BatchFrame
+{
+    string name;
+    uint32_t *pixels; // padded panorama, then the warped frame
+};
+
+static bool isImage(const string &fn)
+{
+    const char *ext[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga"};
+
+    string lower = fn;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    for(size_t i=0; i<sizeof(ext)/sizeof(ext[0]); i++)
+    {
+        size_t n = strlen(ext[i]);
+        if(lower.size() > n && lower.compare(lower.size()-n, n, ext[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static string pngName(const string &fn)
+{
+    return fn.substr(0, fn.rfind('.')) + ".png";
+}
+
+int batchWarp(const DeformMap &dm, size_t dimx, size_t dimy, string indir, string outdir)
+{
+    // inputs
+    vector<string> names;
+
+    DIR *dir = opendir(indir.c_str());
+    if(dir == NULL)
+    {
+        std::cout<<"Can't open input directory "<<indir<<std::endl;
+        return -1;
+    }
+    while(struct dirent *entry = readdir(dir))
+    {
+        if(isImage(entry->d_name))
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+
+    // fastest engine around the cylinder; frames are warped one after
+    // another on all cores
+    WarpSIMD warp;
+    warp.wrap = true;
+    if(warp.init(dm, dimx, dimy))
+        return -1;
+
+    WarpPool pool;
+    if(pool.start(&warp))
+        return -1;
+
+    size_t cores = thread::hardware_concurrency();
+    size_t ncoders = cores > 2 ? cores/2 : 1;
+
+    std::cout<<"warping "<<names.size()<<" images with "<<warp.name()<<" on "<<pool.size()
+             <<" threads, "<<ncoders<<" decoders and encoders"<<std::endl;
+
+    BoundedQueue<size_t> todo(names.size() + 1);
+    BoundedQueue<BatchFrame> decoded(2*ncoders), warped(2*ncoders);
+
+    for(size_t i=0; i<names.size(); i++)
+        todo.push(i);
+    todo.close();
+
+    size_t skipped = 0, done = 0;
+    mutex counter;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+    // decode
+    vector<thread> decoders;
+    for(size_t t=0; t<ncoders; t++)
+    {
+        decoders.push_back(thread([&]() {
+            size_t i;
+            while(todo.pop(i))
+            {
+                int w, h, n;
+                BatchFrame f;
+                f.name = names[i];
+                uint32_t *image = (uint32_t*)stbi_load((indir + "/" + f.name).c_str(), &w, &h, &n, 4);
+
+                if(image == NULL || (size_t)w != dimx || (size_t)h != dimy)
+                {
+                    std::cout<<"skip "<<f.name<<": not a "<<dimx<<"x"<<dimy<<" image"<<std::endl;
+                    stbi_image_free(image);
+                    lock_guard<mutex> lock(counter);
+                    skipped++;
+                    continue;
+                }
+
+                try
+                {
+                    f.pixels = new uint32_t [warp.srcStride*dimy];
+                }
+                catch(...)
+                {
+                    std::cout<<"Fail to allocate memory for "<<f.name<<std::endl;
+                    stbi_image_free(image);
+                    lock_guard<mutex> lock(counter);
+                    skipped++;
+                    continue;
+                }
+                padPanorama(image, dimx, dimy, f.pixels);
+                stbi_image_free(image);
+                decoded.push(f);
+            }
+        }));
+    }
+
+    // warp
+    thread warper([&]() {
+        BatchFrame f;
+        while(decoded.pop(f))
+        {
+            uint32_t *panorama = f.pixels;
+            try
+            {
+                f.pixels = new uint32_t [dm.width*dm.height];
+            }
+            catch(...)
+            {
+                std::cout<<"Fail to allocate memory for "<<f.name<<std::endl;
+                delete []panorama;
+                lock_guard<mutex> lock(counter);
+                skipped++;
+                continue;
+            }
+            pool.run(panorama, f.pixels);
+            delete []panorama;
+            warped.push(f);
+        }
+    });
+
+    // encode
+    vector<thread> encoders;
+    for(size_t t=0; t<ncoders; t++)
+    {
+        encoders.push_back(thread([&]() {
+            BatchFrame f;
+            while(warped.pop(f))
+            {
+                string fn = outdir + "/" + pngName(f.name);
+                bool ok = stbi_write_png(fn.c_str(), dm.width, dm.height, 4, f.pixels, 4*dm.width) != 0;
+                delete []f.pixels;
+
+                lock_guard<mutex> lock(counter);
+                if(ok)
+                    done++;
+                else
+                {
+                    std::cout<<"Fail to write "<<fn<<std::endl;
+                    skipped++;
+                }
+            }
+        }));
+    }
+
+    for(size_t t=0; t<decoders.size(); t++)
+        decoders[t].join();
+    decoded.close();
+    warper.join();
+    warped.close();
+    for(size_t t=0; t<encoders.size(); t++)
+        encoders[t].join();
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    printf("%zu frames in %.3f s, %.1f frames/s, %zu skipped\n", done, elapsed, done/elapsed, skipped);
+
+    return skipped ? -1 : 0;
+}
@@ -0,0 +1,20 @@
+// batch warping of panorama images for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// every dimx x dimy image in indir is decoded, warped on the CPU and
+// written to outdir as PNG under the same name. decoding, warping and
+// encoding run as a pipeline of threads connected by bounded queues, so
+// at most a few frames per stage are in memory at any time.
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <string>
+
+#include "deform.h"
+
+int batchWarp(const DeformMap &dm, size_t dimx, size_t dimy, std::string indir, std::string outdir);
+
+#endif // BATCH_H
@@ -0,0 +1,85 @@
+// bit-plane packing for DLP pattern mode
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include <string.h>
+#include <iostream>
+
+#include "bitplane.h"
+#include "warp.h"
+
+void packSpan_scalar(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither)
+{
+    packSpanAny<VecScalar>(sub, planes, offset, out, n, dither);
+}
+
+// fastest first
+static const struct
+{
+    const char *name;
+    PackSpanFunc span;
+} isas[] = {
+#ifdef WARP_X86
+    {"avx512", packSpan_avx512},
+    {"avx2", packSpan_avx2},
+    {"sse4", packSpan_sse4},
+#endif
+    {"scalar", packSpan_scalar},
+};
+
+Bitplanes::Bitplanes(const char *name)
+{
+    isa = name ? name : WarpSIMD::best();
+    span = NULL;
+    planes = bits = 0;
+    width = height = 0;
+
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+    {
+        if(strcmp(isa, isas[i].name) == 0)
+        {
+            isa = isas[i].name;
+            span = isas[i].span;
+        }
+    }
+}
+
+int Bitplanes::init(size_t n, size_t w, size_t h, uint32_t mode)
+{
+    if(span == NULL || !WarpSIMD::supported(isa))
+    {
+        std::cout<<"Bit-plane kernel "<<isa<<" is not supported on this CPU"<<std::endl;
+        return -1;
+    }
+
+    if(!valid(n))
+    {
+        std::cout<<n<<" subframes do not pack into 24 bit planes"<<std::endl;
+        return -1;
+    }
+
+    planes = n;
+    bits = 24 / n;
+    width = w;
+    height = h;
+
+    return dither.type == mode ? 0 : dither.init(mode);
+}
+
+void Bitplanes::run(const uint32_t *const *subframes, uint32_t *dst, size_t y0, size_t y1)
+{
+    // rows are contiguous, so the whole band is one span
+    if(dither.type == DITHER_NONE)
+    {
+        span(subframes, planes, y0*width, dst + y0*width, (y1 - y0)*width, NULL);
+        return;
+    }
+
+    // the thresholds depend on the row
+    PackDither d = { &dither.threshold[0], dither.size, dither.stride, 0, 0 };
+    for(size_t y=y0; y<y1; y++)
+    {
+        d.y = y;
+        span(subframes, planes, y*width, dst + y*width, width, &d);
+    }
+}
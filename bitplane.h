@@ -0,0 +1,52 @@
+// bit-plane packing for DLP pattern mode
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// in pattern mode a DLP projector shows the bits of one 24-bit RGB frame
+// as separate monochrome patterns, so N warped subframes are packed into
+// one output frame: 24 one-bit, 12 two-bit, ..., 3 eight-bit planes, or
+// 2 twelve-bit and 1 24-bit plane holding a subframe in more levels.
+// subframe i goes to bits [i*bits, (i+1)*bits), i.e. R holds the first
+// 8/bits subframes. fsPack in curve2dmap.cc does the same on the GPU.
+// few bits band, so the quantization can be dithered (dither.h) on the fly.
+//
+
+#ifndef BITPLANE_H
+#define BITPLANE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "warp_kernel.h"
+#include "dither.h"
+
+class Bitplanes
+{
+public:
+    // isa as for WarpSIMD, NULL for the best one this CPU has
+    Bitplanes(const char *isa = NULL);
+
+    // planes must divide 24, dither is a DitherMode
+    int init(size_t planes, size_t width, size_t height, uint32_t dither = DITHER_NONE);
+
+    // pack rows [y0, y1) of subframes[0..planes) into dst
+    void run(const uint32_t *const *subframes, uint32_t *dst, size_t y0, size_t y1);
+
+    void run(const uint32_t *const *subframes, uint32_t *dst)
+    {
+        run(subframes, dst, 0, height);
+    }
+
+    static bool valid(size_t planes)
+    {
+        return planes > 0 && planes <= 24 && 24 % planes == 0;
+    }
+
+public:
+    const char *isa;
+    PackSpanFunc span;
+    size_t planes, bits;
+    size_t width, height;
+    Dither dither;
+};
+
+#endif // BITPLANE_H
@@ -0,0 +1,390 @@
+// soft-edge blending of overlapping projectors for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "blend.h"
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// f(i) for every i in [0, n), threads pull the next index
+template<class F>
+static void parallel(size_t n, size_t threads, F f)
+{
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for(size_t t=0; t<threads && t<n; t++)
+    {
+        pool.push_back(thread([&]() {
+            for(size_t i; (i = next++) < n; )
+                f(i);
+        }));
+    }
+    for(size_t t=0; t<pool.size(); t++)
+        pool[t].join();
+}
+
+static inline float distanceAt(const vector<float> &d, long x, long y, size_t w, size_t h)
+{
+    return (x < 0 || y < 0 || x >= (long)w || y >= (long)h) ? 0.0f : d[y*w + x];
+}
+
+// distance of every valid pixel to the nearest invalid one or the frame
+// edge, by two chamfer passes with steps 1 and sqrt(2); 0 if invalid
+static void edgeDistance(const DeformMap &dm, vector<float> &d)
+{
+    const long w = dm.width, h = dm.height;
+    const float diagonal = 1.41421356f;
+
+    d.assign(w*h, 0.0f);
+    for(long y=0; y<h; y++)
+        for(long x=0; x<w; x++)
+            if(dm.valid(x, y))
+                d[y*w + x] = (float)(w + h);
+
+    for(long y=0; y<h; y++)
+    {
+        for(long x=0; x<w; x++)
+        {
+            float &v = d[y*w + x];
+            if(v == 0.0f)
+                continue;
+            v = fminf(v, distanceAt(d, x-1, y, w, h) + 1.0f);
+            v = fminf(v, distanceAt(d, x, y-1, w, h) + 1.0f);
+            v = fminf(v, distanceAt(d, x-1, y-1, w, h) + diagonal);
+            v = fminf(v, distanceAt(d, x+1, y-1, w, h) + diagonal);
+        }
+    }
+
+    for(long y=h-1; y>=0; y--)
+    {
+        for(long x=w-1; x>=0; x--)
+        {
+            float &v = d[y*w + x];
+            if(v == 0.0f)
+                continue;
+            v = fminf(v, distanceAt(d, x+1, y, w, h) + 1.0f);
+            v = fminf(v, distanceAt(d, x, y+1, w, h) + 1.0f);
+            v = fminf(v, distanceAt(d, x+1, y+1, w, h) + diagonal);
+            v = fminf(v, distanceAt(d, x-1, y+1, w, h) + diagonal);
+        }
+    }
+}
+
+// one triangle of projector pixels into the panorama, the distance
+// interpolated over it and the largest kept; s is already continuous
+// across the seam, columns wrap when written
+static void rasterize(const float s[3], const float t[3], const float d[3], size_t dimx, size_t dimy, vector<float> &f)
+{
+    const long n = dimx, m = dimy;
+
+    float area = (s[1] - s[0])*(t[2] - t[0]) - (s[2] - s[0])*(t[1] - t[0]);
+    if(area == 0.0f)
+        return;
+
+    // pixel centers at integer + 0.5 inside the bounds
+    long i0 = (long)ceilf(fminf(s[0], fminf(s[1], s[2])) - 0.5f);
+    long i1 = (long)floorf(fmaxf(s[0], fmaxf(s[1], s[2])) - 0.5f);
+    long j0 = (long)ceilf(fminf(t[0], fminf(t[1], t[2])) - 0.5f);
+    long j1 = (long)floorf(fmaxf(t[0], fmaxf(t[1], t[2])) - 0.5f);
+    j0 = j0 < 0 ? 0 : j0;
+    j1 = j1 >= m ? m - 1 : j1;
+
+    for(long j=j0; j<=j1; j++)
+    {
+        for(long i=i0; i<=i1; i++)
+        {
+            float u = i + 0.5f, v = j + 0.5f;
+            float b1 = ((u - s[0])*(t[2] - t[0]) - (s[2] - s[0])*(v - t[0]))/area;
+            float b2 = ((s[1] - s[0])*(v - t[0]) - (u - s[0])*(t[1] - t[0]))/area;
+            float b0 = 1.0f - b1 - b2;
+            if(b0 < 0.0f || b1 < 0.0f || b2 < 0.0f)
+                continue;
+
+            float value = b0*d[0] + b1*d[1] + b2*d[2];
+            float &dst = f[j*n + ((i % n) + n) % n];
+            if(value > dst)
+                dst = value;
+        }
+    }
+}
+
+// the distances carried into the panorama, the largest per pixel: every
+// 2x2 cell of valid projector pixels as two triangles, so a projector
+// coarser than the panorama leaves no holes
+static void footprint(const DeformMap &dm, const vector<float> &d, size_t dimx, size_t dimy, vector<float> &f)
+{
+    const size_t w = dm.width;
+    const float half = 0.5f*dimx;
+
+    f.assign(dimx*dimy, 0.0f);
+    for(size_t y=0; y+1<dm.height; y++)
+    {
+        for(size_t x=0; x+1<w; x++)
+        {
+            size_t corner[4] = {y*w + x, y*w + x + 1, (y + 1)*w + x, (y + 1)*w + x + 1};
+            float s[4], t[4], v[4];
+            bool valid = true;
+            for(int c=0; c<4 && valid; c++)
+            {
+                v[c] = d[corner[c]];
+                valid = v[c] > 0.0f;
+                dm.st(corner[c] % w, corner[c] / w, s[c], t[c]);
+            }
+            if(!valid)
+                continue;
+
+            for(int c=1; c<4; c++)
+            {
+                if(s[c] - s[0] > half)
+                    s[c] -= dimx;
+                else if(s[0] - s[c] > half)
+                    s[c] += dimx;
+            }
+
+            float sa[3] = {s[0], s[1], s[3]}, ta[3] = {t[0], t[1], t[3]}, va[3] = {v[0], v[1], v[3]};
+            float sb[3] = {s[0], s[3], s[2]}, tb[3] = {t[0], t[3], t[2]}, vb[3] = {v[0], v[3], v[2]};
+            rasterize(sa, ta, va, dimx, dimy, f);
+            rasterize(sb, tb, vb, dimx, dimy, f);
+        }
+    }
+}
+
+// bilinear, texel centers at integer + 0.5, around the cylinder in s
+static float sampleFootprint(const vector<float> &f, size_t dimx, size_t dimy, float s, float t)
+{
+    const long n = dimx, m = dimy;
+
+    float u = s - 0.5f, v = t - 0.5f;
+    float fu = floorf(u), fv = floorf(v);
+    float a = u - fu, b = v - fv;
+
+    long i0 = (long)fu, j0 = (long)fv;
+    long i1 = ((i0 + 1) % n + n) % n, j1 = j0 + 1;
+    i0 = (i0 % n + n) % n;
+    j0 = j0 < 0 ? 0 : (j0 >= m ? m - 1 : j0);
+    j1 = j1 < 0 ? 0 : (j1 >= m ? m - 1 : j1);
+
+    return (1.0f - b)*((1.0f - a)*f[j0*n + i0] + a*f[j0*n + i1])
+         + b*((1.0f - a)*f[j1*n + i0] + a*f[j1*n + i1]);
+}
+
+static string cacheName(const Rig::Projector &p)
+{
+    return p.file + ".blend";
+}
+
+// a stale or missing cache is not an error, the weights are recomputed
+static int loadWeights(string fn, const DeformMap &dm, uint32_t key, vector<uint16_t> &w)
+{
+    ifstream file(fn.c_str(), ios::in|ios::binary);
+    if(!file.is_open())
+        return -1;
+
+    BlendHeader header;
+    if(!file.read((char*)&header, sizeof(BlendHeader))
+       || memcmp(header.magic, BLEND_MAGIC, 4) != 0
+       || header.version != BLEND_VERSION
+       || header.width != dm.width || header.height != dm.height
+       || header.key != key)
+        return -1;
+
+    w.resize(dm.width*dm.height);
+    if(!file.read((char*)&w[0], w.size()*sizeof(uint16_t))
+       || deformChecksum(&w[0], w.size()*sizeof(uint16_t)) != header.checksum)
+        return -1;
+
+    return 0;
+}
+
+static int saveWeights(string fn, const DeformMap &dm, uint32_t key, const vector<uint16_t> &w)
+{
+    BlendHeader header;
+    memset(&header, 0, sizeof(BlendHeader));
+
+    memcpy(header.magic, BLEND_MAGIC, 4);
+    header.version = BLEND_VERSION;
+    header.width = dm.width;
+    header.height = dm.height;
+    header.key = key;
+    header.checksum = deformChecksum(&w[0], w.size()*sizeof(uint16_t));
+
+    ofstream file (fn.c_str(), ios::out|ios::binary|ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout<<"Fail to open "<<fn<<std::endl;
+        return -1;
+    }
+
+    file.write((const char*)&header, sizeof(BlendHeader));
+    file.write((const char*)&w[0], w.size()*sizeof(uint16_t));
+    file.close();
+
+    if(!file)
+    {
+        std::cout<<"Fail to write "<<fn<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+RigBlend::RigBlend()
+{
+    key = 0;
+    cached = 0;
+}
+
+int RigBlend::build(const Rig &rig, size_t dimx, size_t dimy, bool cache, size_t threads)
+{
+    const size_t n = rig.size();
+    if(n < 1 || dimx < 1 || dimy < 1)
+    {
+        std::cout<<"Invalid input for blending"<<std::endl;
+        return -1;
+    }
+
+    if(threads == 0)
+        threads = thread::hardware_concurrency();
+    if(threads == 0)
+        threads = 1;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+    // the key: panorama size and every map, in order
+    vector<uint32_t> fields(4 + 4*n);
+    fields[0] = BLEND_VERSION;
+    fields[1] = dimx;
+    fields[2] = dimy;
+    fields[3] = n;
+    parallel(n, threads, [&](size_t k) {
+        const DeformMap &dm = rig.projectors[k].deform;
+        fields[4 + 4*k] = dm.width;
+        fields[5 + 4*k] = dm.height;
+        fields[6 + 4*k] = dm.type;
+        fields[7 + 4*k] = deformChecksum(dm.data, dm.size());
+    });
+    key = deformChecksum(&fields[0], fields.size()*sizeof(uint32_t));
+
+    weights.assign(n, vector<uint16_t>());
+    cached = 0;
+
+    // the key covers the whole rig, so the caches are current together
+    if(cache)
+    {
+        for(size_t k=0; k<n; k++)
+            if(loadWeights(cacheName(rig.projectors[k]), rig.projectors[k].deform, key, weights[k]) == 0)
+                cached++;
+        if(cached < n)
+            cached = 0;
+    }
+
+    if(cached == 0)
+    {
+        vector< vector<float> > distances(n), footprints(n);
+        parallel(n, threads, [&](size_t k) {
+            edgeDistance(rig.projectors[k].deform, distances[k]);
+            footprint(rig.projectors[k].deform, distances[k], dimx, dimy, footprints[k]);
+        });
+
+        // rows of all projectors, one after another
+        vector<size_t> rows(n + 1, 0);
+        for(size_t k=0; k<n; k++)
+        {
+            const DeformMap &dm = rig.projectors[k].deform;
+            rows[k+1] = rows[k] + dm.height;
+            weights[k].assign(dm.width*dm.height, 0xffff);
+        }
+
+        parallel(rows[n], threads, [&](size_t r) {
+            size_t k = 0;
+            while(rows[k+1] <= r)
+                k++;
+            const DeformMap &dm = rig.projectors[k].deform;
+            size_t y = r - rows[k];
+
+            for(size_t x=0; x<dm.width; x++)
+            {
+                float d = distances[k][y*dm.width + x];
+                if(d == 0.0f)
+                    continue;
+
+                float s, t;
+                dm.st(x, y, s, t);
+                float others = 0.0f;
+                for(size_t j=0; j<n; j++)
+                    if(j != k)
+                        others += sampleFootprint(footprints[j], dimx, dimy, s, t);
+
+                weights[k][y*dm.width + x] = (uint16_t)(65535.0f*d/(d + others) + 0.5f);
+            }
+        });
+
+        if(cache)
+            for(size_t k=0; k<n; k++)
+                saveWeights(cacheName(rig.projectors[k]), rig.projectors[k].deform, key, weights[k]);
+    }
+
+    // a projector that overlaps no other keeps its gains as they are
+    size_t overlapping = 0;
+    for(size_t k=0; k<n; k++)
+    {
+        size_t i = 0;
+        while(i < weights[k].size() && weights[k][i] == 0xffff)
+            i++;
+        if(i == weights[k].size())
+            weights[k].clear();
+        else
+            overlapping++;
+    }
+
+    double ms = 1e3*chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    std::cout<<"blend of "<<n<<" projectors, "<<overlapping<<" overlapping, "
+             <<(cached ? "cached" : "computed")<<" in "<<ms<<" ms"<<std::endl;
+
+    return 0;
+}
+
+int RigBlend::apply(Rig &rig) const
+{
+    if(weights.size() != rig.size())
+    {
+        std::cout<<"Blend weights do not match the rig"<<std::endl;
+        return -1;
+    }
+
+    // one gamma for the rig, as the warp needs
+    float gamma = -1.0f;
+    for(size_t k=0; k<rig.size() && gamma < 0.0f; k++)
+        if(rig.projectors[k].deform.gain)
+            gamma = rig.projectors[k].deform.gamma;
+
+    for(size_t k=0; k<rig.size(); k++)
+    {
+        if(weights[k].empty())
+            continue;
+
+        DeformMap &dm = rig.projectors[k].deform;
+        const uint16_t *w = &weights[k][0];
+        size_t count = dm.width*dm.height;
+
+        std::vector<uint32_t> gain(count);
+        for(size_t i=0; i<count; i++)
+        {
+            uint32_t g = dm.gain ? dm.gain[i] : packGain(1.0f, 0.0f);
+            gain[i] = (g & 0xffff0000) | (((g & 0xffff)*w[i] + 32767)/65535);
+        }
+
+        if(setDeformGain(dm, &gain[0], dm.gain || gamma < 0.0f ? dm.gamma : gamma))
+            return -1;
+    }
+
+    return 0;
+}
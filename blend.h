@@ -0,0 +1,67 @@
+// soft-edge blending of overlapping projectors for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// where the footprints of the projectors of a rig (rig.h) overlap on the
+// screen, the panorama is shown more than once and comes out too bright.
+// every projector pixel gets a weight, its share of the light at its
+// panorama position (s,t)
+//
+//     w_k = d_k / (d_k + sum_j D_j(s,t)),   j != k
+//
+// d_k is the distance of the pixel to the edge of projector k's valid
+// pixels, in projector pixels, and D_j the same distance of projector j
+// carried into the panorama, its footprint. the weights of the
+// projectors meeting at a point add up to about one and ramp down
+// towards every edge that lies inside another image. they multiply the
+// photometric gains (photometric.h), i.e. they scale linear light, and
+// the warp applies them with the gains at no extra cost.
+//
+// distances, footprints and weights are computed by threads over the
+// maps and rows. the weights are cached next to each map as <map>.blend,
+// unorm16 after a BlendHeader, and reused while the rig key matches: the
+// panorama size and every map of the rig, in order.
+//
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "rig.h"
+
+#define BLEND_MAGIC "BLND"
+#define BLEND_VERSION 1
+
+struct BlendHeader
+{
+    char magic[4];      // BLEND_MAGIC
+    uint32_t version;   // BLEND_VERSION
+    uint32_t width;     // projector pixels
+    uint32_t height;
+    uint32_t key;       // of the rig the weights belong to
+    uint32_t checksum;  // crc32 of the weights
+};
+
+class RigBlend
+{
+public:
+    RigBlend();
+
+    // weights of every projector of rig, from the caches if they are
+    // current, else computed and cached; threads 0 for all cores
+    int build(const Rig &rig, size_t dimx, size_t dimy, bool cache = true, size_t threads = 0);
+
+    // fold the weights into the gains of the maps; a map without gains
+    // gets them with the gamma of the others. projectors that overlap no
+    // other are left alone
+    int apply(Rig &rig) const;
+
+public:
+    std::vector< std::vector<uint16_t> > weights; // unorm16 per pixel, empty if all ones
+    uint32_t key;
+    size_t cached;  // projectors whose weights came from their cache
+};
+
+#endif // BLEND_H
@@ -8,11 +8,13 @@
 //
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <limits>
+#include <chrono>
 using namespace std;
 
 //
@@ -37,15 +39,32 @@ using namespace glm;
 #include "stb_image.h"
 #include "stb_image_write.h"
 
+#include "deform.h"
+#include "readback.h"
+#include "recorder.h"
+#include "headless.h"
+#include "batch.h"
+#include "bitplane.h"
+#include "scene.h"
+#include "procedural.h"
+#include "mesh.h"
+#include "validity.h"
+#include "roi.h"
+#include "photometric.h"
+#include "dither.h"
+#include "rig.h"
+#include "blend.h"
+
 // input
 const size_t dimx = 1440;
 const size_t dimy = 360;
 
-// output
-const size_t width = 608;
-const size_t height = 684;
+// output, taken from the deformation header if it has one
+size_t width = 608;
+size_t height = 684;
 
-// deformation RG32F
+// deformation, warped as stored unless re-encoded with "encoding"; a rig
+// file lists one per projector instead
 string deformFile = "transformation/deform.bin";
 char outFile[] = "result/output.bin";
 
@@ -124,45 +143,90 @@ static void mouseButton_callback(GLFWwindow* window, int button, int action, int
     }
 }
 
-int loadDeform(char *p, string fn)
-{
-    ifstream file (fn.c_str(), ios::in|ios::binary|ios::ate);
-    if (file.is_open())
-    {
-        size_t size = file.tellg();
-        
-        try
-        {
-            p = new char [size];
-        }
-        catch(...)
-        {
-            std::cout<<"Fail to allocate memory for deformation"<<std::endl;
-            return -1;
-        }
-
-        file.seekg (0, ios::beg);
-        file.read (p, size);
-        file.close();
-    }
-    
-    return 0;
-}
-
-// draw input image
+// draw input image: a unit quad per instance of the scene (scene.h),
+// instance (2*i + copy)*layers + l is shape i in subframe l, at
+// time + l*dt. shapes move and spin about their center from their start
+// time on; the second copy sits one turn away, to the right of a shape
+// in the left half of the panorama and to the left of one in the right
+// half, so a shape hanging over either edge shows on both sides
 const char* vertexShader =
 "#version 330 core \n"
-"layout (location = 0) in vec2 vPos;"
+"layout (location = 0) in vec2 vCorner;"
+"layout (location = 1) in vec2 iPosition;"
+"layout (location = 2) in vec2 iSize;"
+"layout (location = 3) in vec2 iVelocity;"
+"layout (location = 4) in vec4 iColor;"
+"layout (location = 5) in float iStart;"
+"layout (location = 6) in vec2 iRotation;"
+"layout (location = 7) in uint iWrap;"
 "uniform mat4 MVP;"
+"uniform vec2 extent;"
+"uniform int layers;"
+"uniform float time;"
+"uniform float dt;"
+"flat out int vLayer;"
+"flat out vec4 vColor;"
 "void main () {"
-"  gl_Position = MVP * vec4(vPos, 0.0, 1.0);"
+"  int layer = gl_InstanceID % layers;"
+"  int copy = (gl_InstanceID / layers) % 2;"
+"  float t = time + float(layer) * dt - iStart;"
+"  vec2 c = iPosition + 0.5 * iSize + iVelocity * t;"
+"  if ((iWrap & 1u) != 0u) {"
+"    c.x = mod(c.x, extent.x);"
+"    c.x += float(copy) * (c.x < 0.5 * extent.x ? extent.x : -extent.x);"
+"  }"
+"  if ((iWrap & 2u) != 0u) c.y = mod(c.y, extent.y);"
+"  float a = iRotation.x + iRotation.y * t;"
+"  vec2 q = (vCorner - 0.5) * iSize;"
+"  vec2 p = c + vec2(cos(a) * q.x - sin(a) * q.y, sin(a) * q.x + cos(a) * q.y);"
+"  bool hidden = t < 0.0 || (copy == 1 && (iWrap & 1u) == 0u);"
+"  gl_Position = hidden ? vec4(2.0, 2.0, 2.0, 1.0) : MVP * vec4(p, 0.0, 1.0);"
+"  vLayer = layer;"
+"  vColor = iColor;"
+"}";
+
+// routes each instance to its own layer (gl_Layer is not writable from a
+// vertex shader in 3.3 core)
+const char* gsScene =
+"#version 330 core \n"
+"layout (triangles) in;"
+"layout (triangle_strip, max_vertices = 3) out;"
+"flat in int vLayer[];"
+"flat in vec4 vColor[];"
+"flat out vec4 color;"
+"void main () {"
+"  for (int i = 0; i < 3; i++) {"
+"    gl_Layer = vLayer[0];"
+"    color = vColor[0];"
+"    gl_Position = gl_in[i].gl_Position;"
+"    EmitVertex();"
+"  }"
+"  EndPrimitive();"
+"}";
+
+// same for the warp, which also needs the layer to sample from
+const char* gsLayer =
+"#version 330 core \n"
+"layout (triangles) in;"
+"layout (triangle_strip, max_vertices = 3) out;"
+"flat in int vLayer[];"
+"flat out int layer;"
+"void main () {"
+"  for (int i = 0; i < 3; i++) {"
+"    gl_Layer = vLayer[0];"
+"    layer = vLayer[0];"
+"    gl_Position = gl_in[i].gl_Position;"
+"    EmitVertex();"
+"  }"
+"  EndPrimitive();"
 "}";
 
 const char* fragmentShader =
 "#version 330 core \n"
+"flat in vec4 color;"
 "out vec4 fragColor;"
 "void main () {"
-"  fragColor = vec4(1,0,0,1);\n"
+"  fragColor = color;\n"
 "}";
 
 // render to screen
@@ -177,75 +241,408 @@ const char* vsScreen =
 
 const char* fsScreen =
 "#version 330 core \n"
-"uniform sampler2D tex0;"
+"uniform sampler2DArray tex0;"
 "in vec2 texcoord;"
 "out vec4 fragColor;"
 "void main () {"
-"  fragColor = texture(tex0, texcoord);"
+"  fragColor = texture(tex0, vec3(texcoord, 0.0));"
 "}";
 
 // warp
 const char* vsWarp =
 "#version 330 core \n"
 "in vec2 vPos;"
+"flat out int vLayer;"
 "void main () {"
 "  gl_Position = vec4(vPos, 0.0, 1.0);"
+"  vLayer = gl_InstanceID;"
 "}";
 
+// one texel of the deformation per fragment gives the panorama position,
+// which is the only (dependent) filtered fetch, from the subframe's layer.
+// sentinel is compared with the texel as stored, decode scales it to
+// panorama pixels (RG16 texels are normalized codes). tex0 only holds the
+// source region roi (roi.h) of the w x h panorama; when it is narrower
+// than the panorama, s is taken around the cylinder from the middle of
+// the unused columns. with photometric set the sample is corrected as in
+// photometric.h: tex2 holds the gains (gain, black level), row 0 of tex3
+// the decode table and row 1 the encode table. the maps and gains of the
+// projectors of a rig (rig.h) are layers of tex1 and tex2, a draw covers
+// projector, whose map starts at origin of the output
 const char* fsWarp =
 "#version 330 core \n"
 "uniform float w;"
 "uniform float h;"
-"uniform sampler2D tex0;"
-"uniform sampler2D tex1;"
+"uniform vec4 roi;"
+"uniform float sentinel;"
+"uniform vec2 decode;"
+"uniform int projector;"
+"uniform ivec2 origin;"
+"uniform sampler2DArray tex0;"
+"uniform sampler2DArray tex1;"
+"uniform int photometric;"
+"uniform sampler2DArray tex2;"
+"uniform sampler2D tex3;"
+"flat in int layer;"
 "out vec4 fragColor;"
+"vec3 source (vec2 st) {"
+"  float gap = 0.5 * (w - roi.z);"
+"  float s = roi.z < w ? mod(st.s - roi.x + gap, w) - gap : st.s - roi.x;"
+"  return vec3(vec2(s, st.t - roi.y) / roi.zw, layer);"
+"}"
+"vec4 correct (vec4 c) {"
+"  vec2 gb = texelFetch(tex2, ivec3(ivec2(gl_FragCoord.xy) - origin, projector), 0).rg;"
+"  float scale = gb.x * (1.0 - gb.y);"
+"  float levels = float(textureSize(tex3, 0).x - 1);"
+"  ivec3 v = ivec3(c.rgb * 255.0 + 0.5);"
+"  vec3 l = vec3(texelFetch(tex3, ivec2(v.r, 0), 0).r, texelFetch(tex3, ivec2(v.g, 0), 0).r,"
+"                texelFetch(tex3, ivec2(v.b, 0), 0).r) * scale + gb.y;"
+"  ivec3 q = ivec3(l * levels + 0.5);"
+"  return vec4(texelFetch(tex3, ivec2(q.r, 1), 0).r, texelFetch(tex3, ivec2(q.g, 1), 0).r,"
+"              texelFetch(tex3, ivec2(q.b, 1), 0).r, c.a);"
+"}"
 "void main () {"
-//"  vec4 texcoord = texture2D(tex1, gl_TexCoord[0].st);"
-//"  gl_FragColor = vec4(texture2D(tex0, vec2(texcoord.s/w, texcoord.t/h)).a, 0.0, 0.0, 1.0);"
-//"  fragColor = texture2D(tex0, vec2(texcoord.s/w, texcoord.t/h));"
+"  vec2 st = texelFetch(tex1, ivec3(ivec2(gl_FragCoord.xy) - origin, projector), 0).rg;"
+"  if (st.s == sentinel || st.t == sentinel)"
+"    fragColor = vec4(0.0, 0.0, 0.0, 1.0);"
+"  else {"
+"    vec4 c = texture(tex0, source(st * decode));"
+"    fragColor = photometric != 0 ? correct(c) : c;"
+"  }"
+"}";
+
+// mesh mode: the deformation as a triangle mesh (mesh.h), the rasterizer
+// interpolates (s,t); pixels without source are not covered
+const char* vsMesh =
+"#version 330 core \n"
+"layout (location = 0) in vec2 vPos;"
+"layout (location = 1) in vec2 vST;"
+"uniform vec2 size;"
+"flat out int vLayer;"
+"out vec2 vTex;"
+"void main () {"
+"  gl_Position = vec4(2.0 * vPos / size - 1.0, 0.0, 1.0);"
+"  vLayer = gl_InstanceID;"
+"  vTex = vST;"
+"}";
+
+const char* gsMesh =
+"#version 330 core \n"
+"layout (triangles) in;"
+"layout (triangle_strip, max_vertices = 3) out;"
+"flat in int vLayer[];"
+"in vec2 vTex[];"
+"flat out int layer;"
+"out vec2 st;"
+"void main () {"
+"  for (int i = 0; i < 3; i++) {"
+"    gl_Layer = vLayer[0];"
+"    layer = vLayer[0];"
+"    st = vTex[i];"
+"    gl_Position = gl_in[i].gl_Position;"
+"    EmitVertex();"
+"  }"
+"  EndPrimitive();"
+"}";
+
+const char* fsMesh =
+"#version 330 core \n"
+"uniform float w;"
+"uniform float h;"
+"uniform vec4 roi;"
+"uniform int projector;"
+"uniform ivec2 origin;"
+"uniform sampler2DArray tex0;"
+"uniform int photometric;"
+"uniform sampler2DArray tex2;"
+"uniform sampler2D tex3;"
+"flat in int layer;"
+"in vec2 st;"
+"out vec4 fragColor;"
+"vec3 source (vec2 st) {"
+"  float gap = 0.5 * (w - roi.z);"
+"  float s = roi.z < w ? mod(st.s - roi.x + gap, w) - gap : st.s - roi.x;"
+"  return vec3(vec2(s, st.t - roi.y) / roi.zw, layer);"
+"}"
+"vec4 correct (vec4 c) {"
+"  vec2 gb = texelFetch(tex2, ivec3(ivec2(gl_FragCoord.xy) - origin, projector), 0).rg;"
+"  float scale = gb.x * (1.0 - gb.y);"
+"  float levels = float(textureSize(tex3, 0).x - 1);"
+"  ivec3 v = ivec3(c.rgb * 255.0 + 0.5);"
+"  vec3 l = vec3(texelFetch(tex3, ivec2(v.r, 0), 0).r, texelFetch(tex3, ivec2(v.g, 0), 0).r,"
+"                texelFetch(tex3, ivec2(v.b, 0), 0).r) * scale + gb.y;"
+"  ivec3 q = ivec3(l * levels + 0.5);"
+"  return vec4(texelFetch(tex3, ivec2(q.r, 1), 0).r, texelFetch(tex3, ivec2(q.g, 1), 0).r,"
+"              texelFetch(tex3, ivec2(q.b, 1), 0).r, c.a);"
+"}"
+"void main () {"
+"  vec4 c = texture(tex0, source(st));"
+"  fragColor = photometric != 0 ? correct(c) : c;"
+"}";
+
+// direct mode: no panorama, the primitives of procedural.h are evaluated
+// at (s,t) in scene coordinates (y down). the pixel footprint in the
+// panorama, from the neighbouring deformation texels, sets the width of
+// the antialiased edges. the map is layer projector of tex1, size x size
+// texels drawn at origin, as in fsWarp
+const char* fsDirect =
+"#version 330 core \n"
+"struct Primitive {"
+"  vec4 rect;"      // x, y, w, h
+"  vec4 motion;"    // vx, vy, start, kind
+"  vec4 rotation;"  // angle, spin, wrap
+"  vec4 color;"
+"  vec4 grating;"   // period, speed, contrast
+"};"
+"layout (std140) uniform Primitives { Primitive prims[200]; };"
+"uniform int count;"
+"uniform float time;"
+"uniform float dt;"
+"uniform vec2 extent;"
+"uniform vec3 background;"
+"uniform float sentinel;"
+"uniform vec2 decode;"
+"uniform int projector;"
+"uniform ivec2 origin;"
+"uniform vec2 size;"
+"uniform sampler2DArray tex1;"
+"flat in int layer;"
+"out vec4 fragColor;"
+"vec2 stAt (ivec2 q, vec2 st) {"
+"  vec2 n = texelFetch(tex1, ivec3(clamp(q, ivec2(0), ivec2(size) - 1), projector), 0).rg;"
+"  return (n.s == sentinel || n.t == sentinel) ? st + vec2(1.0) : n * decode;"
+"}"
+"void main () {"
+"  ivec2 q = ivec2(gl_FragCoord.xy) - origin;"
+"  vec2 st = texelFetch(tex1, ivec3(q, projector), 0).rg;"
+"  if (st.s == sentinel || st.t == sentinel) {"
+"    fragColor = vec4(0.0, 0.0, 0.0, 1.0);"
+"    return;"
+"  }"
+"  st *= decode;"
+"  vec2 p = vec2(st.s, extent.y - st.t);"
+"  float aa = max(length(stAt(q + ivec2(1, 0), st) - st), length(stAt(q + ivec2(0, 1), st) - st));"
+"  aa = clamp(aa, 0.25, 4.0);"
+"  vec3 col = background;"
+"  for (int i = 0; i < count; i++) {"
+"    float t = time + float(layer) * dt - prims[i].motion.z;"
+"    if (t < 0.0) continue;"
+"    vec4 r = prims[i].rect;"
+"    int wrap = int(prims[i].rotation.z);"
+"    int kind = int(prims[i].motion.w);"
+"    vec2 d = p - (r.xy + 0.5 * r.zw + prims[i].motion.xy * t);"
+"    if ((wrap & 1) != 0) d.x -= extent.x * round(d.x / extent.x);"
+"    if ((wrap & 2) != 0) d.y -= extent.y * round(d.y / extent.y);"
+"    float a = prims[i].rotation.x + prims[i].rotation.y * t;"
+"    vec2 u = vec2(cos(a) * d.x + sin(a) * d.y, -sin(a) * d.x + cos(a) * d.y);"
+"    vec2 h = 0.5 * r.zw;"
+"    vec2 e = abs(u) - h;"
+"    float dist = kind == 1 ? (length(u / h) - 1.0) * min(h.x, h.y) : max(e.x, e.y);"
+"    float cover = clamp(0.5 - dist / aa, 0.0, 1.0) * prims[i].color.a;"
+"    vec3 c = prims[i].color.rgb;"
+"    if (kind == 2) {"
+"      vec4 g = prims[i].grating;"
+"      float v = 0.5 + 0.5 * g.z * sin(6.2831853 * (u.x - g.y * t) / g.x);"
+"      c = mix(col, c, v);"
+"    }"
+"    col = mix(col, c, cover);"
+"  }"
+"  fragColor = vec4(col, 1.0);"
+"}";
+
+// the valid pixels of the deformation into the stencil, once per projector
+const char* fsMask =
+"#version 330 core \n"
+"uniform float sentinel;"
+"uniform int projector;"
+"uniform ivec2 origin;"
+"uniform sampler2DArray tex1;"
+"void main () {"
+"  vec2 st = texelFetch(tex1, ivec3(ivec2(gl_FragCoord.xy) - origin, projector), 0).rg;"
+"  if (st.s == sentinel || st.t == sentinel)"
+"    discard;"
+"}";
+
+// DLP pattern mode: the warped subframes are layers of tex0, layer i is
+// quantized to bits and lands in bits [i*bits, (i+1)*bits) of the RGB
+// word, as in bitplane.h, in the same integers as the CPU packers. with
+// dither set the threshold tile of dither.h in tex1 replaces the rounding
+const char* fsPack =
+"#version 330 core \n"
+"uniform sampler2DArray tex0;"
+"uniform usampler2D tex1;"
+"uniform int planes;"
+"uniform int bits;"
+"uniform int dither;"
+"out vec4 fragColor;"
+"void main () {"
+"  ivec2 p = ivec2(gl_FragCoord.xy);"
+"  int levels = (1 << bits) - 1;"
+"  int whole = bits > 8 ? levels / 255 : 0;"
+"  int part = bits > 8 ? levels % 255 : levels;"
+"  int m = dither != 0 ? textureSize(tex1, 0).x - 1 : 0;"
+"  uint word = 0u;"
+"  for (int i = 0; i < planes; i++) {"
+"    int v = int(texelFetch(tex0, ivec3(p, i), 0).r * 255.0 + 0.5);"
+"    int t = v * part + (dither != 0 ? 0 : 127);"
+"    int q = (t + 1 + (t >> 8)) >> 8;"
+"    if (dither != 0) {"
+"      int T = int(texelFetch(tex1, ivec2((p.x + 13*i) & m, (p.y + 7*i) & m), 0).r);"
+"      q += (512*(t - 255*q) + 510*T + 255 + 131584) >> 18;"
+"    }"
+"    word |= uint(q + v * whole) << uint(i * bits);"
+"  }"
+"  fragColor = vec4(uvec3(word, word >> 8u, word >> 16u) & 255u, 255.0) / 255.0;"
 "}";
 
 //
 GLuint fb[2] = {std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max()}; //framebuffers
 GLuint rb[2] = {std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max()}; //renderbuffers, color and depth
-GLuint textures[2] = {std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max()};
+const int PJTEX = 0; // project texture, one layer per subframe
+const int DMTEX = 1; // deformation maps, a layer per projector
+const int OUTTEX = 2; // warped output
+const int SUBTEX = 3; // warped subframes, packed into OUTTEX in pattern mode
+const int PJDEPTH = 4; // depth of PJTEX, layered attachments must all be layered
+const int WARPSTENCIL = 5; // valid pixels of the warp target, layered like it
+const int GAINTEX = 6; // photometric gains of the deformations, layered like them
+const int GAMMATEX = 7; // photometric decode and encode tables
+const int DITHERTEX = 8; // threshold tile of the bit-plane dither
+const int NTEX = 9;
+
+GLuint textures[NTEX] = {std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max(),
+                         std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max(),
+                         std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max(), std::numeric_limits<GLuint>::max()};
 
-const int PJTEX = 0; // project texture
-const int DMTEX = 1; // deformation texture
+// uniforms of the warp programs that change from projector to projector;
+// a program without one gets location -1, which GL ignores
+struct ProjectorUniforms
+{
+    GLint projector, origin, size;
+    GLint sentinel, decode, photometric;
+};
+
+static ProjectorUniforms projectorUniforms(GLuint program)
+{
+    ProjectorUniforms u;
+    u.projector = glGetUniformLocation(program, "projector");
+    u.origin = glGetUniformLocation(program, "origin");
+    u.size = glGetUniformLocation(program, "size");
+    u.sentinel = glGetUniformLocation(program, "sentinel");
+    u.decode = glGetUniformLocation(program, "decode");
+    u.photometric = glGetUniformLocation(program, "photometric");
+    return u;
+}
+
+// per projector values of the warp, texels as stored
+struct ProjectorWarp
+{
+    float sentinel;
+    float decode[2];
+    int photometric;
+    GLint first;      // of its validity blocks, in vertices
+    GLsizei count;
+    size_t meshFirst; // of its mesh triangles, in indices
+    size_t meshCount;
+};
+
+// draw projector k of the rig next: its viewport and uniforms for the
+// bound program
+static void useProjector(const ProjectorUniforms &u, const Rig &rig, size_t k, const ProjectorWarp &w)
+{
+    const Rig::Projector &p = rig.projectors[k];
+    glViewport(p.x, p.y, p.deform.width, p.deform.height);
+    glUniform1i(u.projector, k);
+    glUniform2i(u.origin, p.x, p.y);
+    glUniform2f(u.size, p.deform.width, p.deform.height);
+    glUniform1f(u.sentinel, w.sentinel);
+    glUniform2f(u.decode, w.decode[0], w.decode[1]);
+    glUniform1i(u.photometric, w.photometric);
+}
+
+// read back frames go to the recorder
+static void recordFrame(const void *pixels, uint64_t frame, uint64_t time, void *user)
+{
+    ((Recorder*)user)->push(pixels, frame, time);
+}
 
 //
-// Quadrilateral class
-//  d_______c
-//   |      |
-//   |      |
-//  a|______|b
+// GPU time of one pass. queries are kept a few frames deep and results
+// are only read once available, so timing never stalls the pipeline
 //
-class Quad
+const int NQUERIES = 4;
+
+class PassTimer
 {
 public:
-    void add(glm::vec2 a, glm::vec2 b, glm::vec2 c, glm::vec2 d)
+    void init()
     {
-        positions.push_back(a);
-        positions.push_back(b);
-        positions.push_back(c);
-        
-        positions.push_back(a);
-        positions.push_back(c);
-        positions.push_back(d);
+        glGenQueries(NQUERIES, queries);
+        issued = collected = 0;
+        reset();
     }
     
-    void setColor(glm::vec4 c)
+    void release()
     {
-        color = c;
+        glDeleteQueries(NQUERIES, queries);
     }
     
-public:
-    std::vector<glm::vec2> positions;
-    glm::vec4 color;
+    void begin()
+    {
+        if(issued - collected == NQUERIES)
+            collect(true); // GPU is NQUERIES frames behind
+        glBeginQuery(GL_TIME_ELAPSED, queries[issued % NQUERIES]);
+    }
+    
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued++;
+        collect(false);
+    }
+    
+    // average ms since the last reset
+    double ms() const
+    {
+        return samples ? 1e-6 * total / samples : 0.0;
+    }
+    
+    void reset()
+    {
+        total = 0;
+        samples = 0;
+    }
+    
+private:
+    void collect(bool wait)
+    {
+        while(collected < issued)
+        {
+            GLuint q = queries[collected % NQUERIES];
+            
+            if(!wait)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+                if(!available)
+                    break;
+            }
+            
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+            total += ns;
+            samples++;
+            collected++;
+            wait = false;
+        }
+    }
+    
+private:
+    GLuint queries[NQUERIES];
+    size_t issued, collected;
+    GLuint64 total;
+    size_t samples;
 };
 
-std::vector<Quad> rectangles;
-
 //
 // main func
 //
@@ -256,60 +653,349 @@ int main(int argc, char *argv[])
     //
     
     bool b_debug = false;
+    bool b_record = false;
+    bool b_headless = false;
+    size_t nframes = 0;
+    size_t planes = 0;
+    uint32_t dither = DITHER_NONE;
+    double refresh = 60.0; // frames per second the projector takes
+    float drift = 0.0f;    // horizontal scene motion, pixels per second
+    size_t ndots = 0;
+    bool b_direct = false;
+    bool b_blend = true;
+    size_t meshStep = 0;
+    float meshError = 0.25f;
+    uint32_t encoding = 0; // as stored
+    float gratingPeriod = 0.0f, gratingSpeed = 0.0f;
+    string batchIn, batchOut, imageFile, rigFile;
     
-    if(argc>1)
-    if (strcmp(argv[1], "debug") == 0)
+    for(int i=1; i<argc; i++)
     {
-        b_debug = true;
-        std::cout<<"debugging mode"<<std::endl;
+        if (strcmp(argv[i], "debug") == 0)
+        {
+            b_debug = true;
+            std::cout<<"debugging mode"<<std::endl;
+        }
+        else if (strcmp(argv[i], "record") == 0)
+        {
+            b_record = true;
+            std::cout<<"recording to "<<outFile<<std::endl;
+        }
+        else if (strcmp(argv[i], "headless") == 0)
+        {
+            // headless [frames]
+            b_headless = true;
+            nframes = 3600;
+            if(i+1<argc && isdigit(argv[i+1][0]))
+                nframes = atoi(argv[++i]);
+            std::cout<<"headless mode, "<<nframes<<" frames"<<std::endl;
+        }
+        else if (strcmp(argv[i], "batch") == 0 && i+2<argc)
+        {
+            // batch <indir> <outdir>
+            batchIn = argv[++i];
+            batchOut = argv[++i];
+        }
+        else if (strcmp(argv[i], "image") == 0 && i+1<argc)
+        {
+            // image <panorama>, shown instead of the scene
+            imageFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "planes") == 0 && i+1<argc)
+        {
+            // planes <subframes>, DLP pattern mode
+            planes = atoi(argv[++i]);
+            if(!Bitplanes::valid(planes))
+            {
+                std::cout<<planes<<" subframes do not pack into 24 bit planes"<<std::endl;
+                return -1;
+            }
+            std::cout<<"pattern mode, "<<planes<<" subframes of "<<24/planes<<" bits"<<std::endl;
+        }
+        else if (strcmp(argv[i], "dither") == 0 && i+1<argc)
+        {
+            // dither <none|bayer|blue>, of the bit planes in pattern mode
+            int mode = Dither::mode(argv[++i]);
+            if(mode < 0)
+            {
+                std::cout<<"Unknown dither "<<argv[i]<<std::endl;
+                return -1;
+            }
+            dither = mode;
+        }
+        else if (strcmp(argv[i], "refresh") == 0 && i+1<argc)
+        {
+            // refresh <Hz>, sets the time step of frames and subframes
+            refresh = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "drift") == 0 && i+1<argc)
+        {
+            // drift <pixels/s>, moves the scene so subframes differ
+            drift = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "dots") == 0 && i+1<argc)
+        {
+            // dots <n>, a random dot field on top of the example
+            ndots = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "direct") == 0)
+        {
+            // procedural primitives evaluated in the warp, no panorama pass
+            b_direct = true;
+            std::cout<<"direct mode"<<std::endl;
+        }
+        else if (strcmp(argv[i], "mesh") == 0 && i+1<argc)
+        {
+            // mesh <step> [max error], warp through a triangle mesh
+            meshStep = atoi(argv[++i]);
+            if(i+1<argc)
+            {
+                // taken only if all of it is a number, .5 and 1e-2 too
+                char *end;
+                float e = strtof(argv[i+1], &end);
+                if(end != argv[i+1] && *end == '\0')
+                {
+                    meshError = e;
+                    i++;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "encoding") == 0 && i+1<argc)
+        {
+            // encoding <rg32f|rg16f|rg16>, of the deformation as warped
+            encoding = deformType(argv[++i]);
+            if(encoding == 0)
+            {
+                std::cout<<"Unknown deformation encoding "<<argv[i]<<std::endl;
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "rig") == 0 && i+1<argc)
+        {
+            // rig <file>, the projectors and their deformations (rig.h)
+            rigFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "noblend") == 0)
+        {
+            // overlapping projectors of a rig at full brightness
+            b_blend = false;
+        }
+        else if (strcmp(argv[i], "grating") == 0 && i+2<argc)
+        {
+            // grating <period px> <speed px/s>, behind the example, direct mode
+            gratingPeriod = atof(argv[++i]);
+            gratingSpeed = atof(argv[++i]);
+        }
     }
     
-    // error check
-    glfwSetErrorCallback(error_callback);
-
-    // Init GLFW
-    if( !glfwInit() )
+    // pattern mode renders every subframe in one layered draw
+    size_t subframes = planes ? planes : 1;
+    
+    if(dither != DITHER_NONE && !planes)
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
-        getchar();
+        std::cout<<"dithering applies to the bit planes of pattern mode only"<<std::endl;
+        dither = DITHER_NONE;
+    }
+    
+    if(b_direct && !imageFile.empty())
+    {
+        std::cout<<"an image needs the panorama pass, not direct mode"<<std::endl;
         return -1;
     }
     
-//    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-//    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-//    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE); // fixed window
+    if(b_direct && meshStep)
+    {
+        std::cout<<"direct mode does not warp a panorama, no mesh"<<std::endl;
+        meshStep = 0;
+    }
     
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if(b_direct && b_debug)
+    {
+        std::cout<<"no panorama to debug in direct mode"<<std::endl;
+        b_debug = false;
+    }
     
-    // Open a window and create its OpenGL context
-    if(b_debug)
-        window = glfwCreateWindow( dimx/2, dimy/2, "project image", NULL, NULL); // for debugging
-    else
-        window = glfwCreateWindow( width/2, height/2, "project image", NULL, NULL);
-        
-    if( window == NULL ){
-        fprintf( stderr, "Failed to open GLFW window.\n" );
-        getchar();
-        glfwTerminate();
+    if(b_headless && b_debug)
+    {
+        std::cout<<"no debugging view without a window"<<std::endl;
+        b_debug = false;
+    }
+    
+    // deformations are mapped, not read; pages fault in on upload. the
+    // output spans all projectors, one projector is a rig of one
+    Rig rig;
+    if(rigFile.empty() ? rig.init(deformFile, width, height) : rig.load(rigFile, width, height))
+    {
         return -1;
     }
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, cursorPos_callback);
-    glfwSetMouseButtonCallback(window, mouseButton_callback);
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
-    //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    //glfwSetCursorPos(window, width/2, height/2);
+    width = rig.width;
+    height = rig.height;
+    size_t nprojectors = rig.size();
+    
+    if(!rigFile.empty())
+    {
+        std::cout<<"rig of "<<nprojectors<<" projectors, "<<width<<"x"<<height<<" output"<<std::endl;
+        for(size_t k=0; k<nprojectors; k++)
+        {
+            const Rig::Projector &p = rig.projectors[k];
+            std::cout<<"  "<<p.file<<": "<<p.deform.width<<"x"<<p.deform.height<<" at "<<p.x<<","<<p.y<<std::endl;
+        }
+    }
+    
+    // soft edges where projectors overlap, folded into their gains; from
+    // the maps as loaded, which key the cached weights
+    if(nprojectors > 1 && b_blend)
+    {
+        RigBlend blend;
+        if(blend.build(rig, dimx, dimy) || blend.apply(rig))
+        {
+            return -1;
+        }
+    }
+    
+    // re-encoded once, CPU and GPU then warp the same values; all maps
+    // end up in one encoding, the layers of one texture: the one asked
+    // for, else the first map's, so RG16 maps stay RG16
+    if(encoding == 0)
+        encoding = rig.projectors[0].deform.type;
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        DeformMap &deform = rig.projectors[k].deform;
+        if(encoding != deform.type)
+        {
+            if(convertDeform(deform, deform, encoding, dimx, dimy))
+            {
+                return -1;
+            }
+            std::cout<<rig.projectors[k].file<<" encoded as "<<deformTypeName(deform.type)<<std::endl;
+        }
+    }
+    
+    // the part of the panorama the projectors see: the scene is only
+    // rendered there, once for all of them, and PJTEX only holds it. mesh
+    // (s,t) are off by up to the mesh error
+    SourceROI roi;
+    roi.init(dimx, dimy);
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        if(roi.add(rig.projectors[k].deform, meshStep ? 1 + (int)ceil(meshError) : 1))
+        {
+            return -1;
+        }
+    }
+    if(roi.w <= 0 || roi.h <= 0)
+    {
+        roi.x = roi.y = 0;
+        roi.w = dimx;
+        roi.h = dimy;
+    }
+    
+    SourceROI::Piece pieces[2];
+    size_t npieces = roi.pieces(pieces);
+    
+    if(!b_direct)
+    {
+        std::cout<<"source region "<<roi.w<<"x"<<roi.h<<" at "<<roi.x<<","<<roi.y<<" ("
+                 <<100.0*roi.w*roi.h/(dimx*dimy)<<"% of the panorama, "<<npieces<<" pieces)"<<std::endl;
+    }
+    
+    // texel as stored and its scale to panorama pixels
+    std::vector<ProjectorWarp> warps(nprojectors);
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        const DeformMap &deform = rig.projectors[k].deform;
+        ProjectorWarp &w = warps[k];
+        w.sentinel = deform.type == DEFORM_RG16 ? 1.0f : deform.sentinel;
+        w.decode[0] = w.decode[1] = 1.0f;
+        if(deform.type == DEFORM_RG16)
+        {
+            w.decode[0] = deform.scale[0]*DEFORM_RG16_SENTINEL;
+            w.decode[1] = deform.scale[1]*DEFORM_RG16_SENTINEL;
+        }
+        w.photometric = deform.gain != NULL;
+        w.first = w.count = 0;
+        w.meshFirst = w.meshCount = 0;
+    }
     
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+    // offline, on the CPU only
+    if(!batchIn.empty())
+    {
+        if(nprojectors > 1)
+        {
+            std::cout<<"batch warps a single deformation, not a rig"<<std::endl;
+            return -1;
+        }
+        return batchWarp(rig.projectors[0].deform, dimx, dimy, batchIn, batchOut);
+    }
+    
+    unsigned char *image = NULL;
+    if(!imageFile.empty())
+    {
+        int w, h, n;
+        image = stbi_load(imageFile.c_str(), &w, &h, &n, 4);
+        if(image == NULL || (size_t)w != dimx || (size_t)h != dimy)
+        {
+            std::cout<<imageFile<<" is not a "<<dimx<<"x"<<dimy<<" image"<<std::endl;
+            return -1;
+        }
+    }
+    
+    if(b_headless)
+    {
+        if(createHeadlessContext())
+            return -1;
+    }
+    else
+    {
+        // error check
+        glfwSetErrorCallback(error_callback);
+
+        // Init GLFW
+        if( !glfwInit() )
+        {
+            fprintf( stderr, "Failed to initialize GLFW\n" );
+            getchar();
+            return -1;
+        }
+    
+    //    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    //    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    //    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE); // fixed window
+    
+        glfwWindowHint(GLFW_SAMPLES, 0); // the window only gets blits
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    
+        // Open a window and create its OpenGL context
+        if(b_debug)
+            window = glfwCreateWindow( dimx/2, dimy/2, "project image", NULL, NULL); // for debugging
+        else
+            window = glfwCreateWindow( width/2, height/2, "project image", NULL, NULL);
+        
+        if( window == NULL ){
+            fprintf( stderr, "Failed to open GLFW window.\n" );
+            getchar();
+            glfwTerminate();
+            return -1;
+        }
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetCursorPosCallback(window, cursorPos_callback);
+        glfwSetMouseButtonCallback(window, mouseButton_callback);
+        glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+        //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        //glfwSetCursorPos(window, width/2, height/2);
+    
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(1);
+    }
 
     // Init GLEW
+    // (a GLX build of GLEW finds no GLX display under EGL, which is fine)
     glewExperimental = true;
-    if (glewInit() != GLEW_OK) {
+    GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK && !(b_headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY)) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
         glfwTerminate();
@@ -317,12 +1003,18 @@ int main(int argc, char *argv[])
     }
     
     //
-    // projection matrix
-    glm::mat4 projectionMatrix = glm::ortho(0.0f,(float)dimx,(float)dimy,0.0f);
+    // projection matrix, one per piece of the source region; texture rows
+    // are t, which runs against the scene's y
     glm::mat4 viewMatrix =  glm::mat4(1.0f);
     glm::mat4 modelMatrix = glm::mat4(1.0f);
     
-    glm::mat4 mvp = projectionMatrix * viewMatrix * modelMatrix;
+    glm::mat4 pieceMVP[2];
+    for(size_t i=0; i<npieces; i++)
+    {
+        const SourceROI::Piece &p = pieces[i];
+        glm::mat4 projectionMatrix = glm::ortho((float)p.x, (float)(p.x + p.w), (float)(dimy - p.y), (float)(dimy - p.y - p.h));
+        pieceMVP[i] = projectionMatrix * viewMatrix * modelMatrix;
+    }
     
     //
     GLenum g_drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
@@ -332,12 +1024,72 @@ int main(int argc, char *argv[])
     //
     
     // Example Data Generated
-    Quad rect;
-    rect.add(glm::vec2(650,60), glm::vec2(700,60), glm::vec2(700,300), glm::vec2(650,300));
-    rect.setColor(glm::vec4(1.0,0.0,0.0,1.0));
+    Shape bar; // red bar
+    bar.x = 650;
+    bar.y = 60;
+    bar.w = 50;
+    bar.h = 240;
+    bar.color = 0xff0000ff;
+    bar.vx = drift;
+    
+    std::vector<Shape> dots(ndots);
+    srand(1);
+    for(size_t i=0; i<ndots; i++)
+    {
+        dots[i].x = rand() % dimx;
+        dots[i].y = rand() % dimy;
+        dots[i].w = dots[i].h = 4;
+        dots[i].vx = drift;
+        dots[i].wrap = SCENE_WRAP_X | SCENE_WRAP_Y;
+    }
+    
+    // written once; frames only draw it
+    Scene scene;
+    Procedural procedural;
+    
+    if(b_direct)
+    {
+        if(procedural.init())
+            return -1;
+        
+        if(gratingPeriod > 0)
+        {
+            Shape region;
+            region.w = dimx;
+            region.h = dimy;
+            region.color = 0xffffffff;
+            region.wrap = 0;
+            procedural.addGrating(region, gratingPeriod, gratingSpeed);
+        }
+        
+        procedural.add(bar);
+        for(size_t i=0; i<ndots; i++)
+        {
+            if(procedural.add(dots[i], PRIM_DOT) < 0)
+            {
+                std::cout<<"only "<<PROCEDURAL_MAX<<" primitives in direct mode"<<std::endl;
+                break;
+            }
+        }
+        std::cout<<procedural.primitives.size()<<" primitives"<<std::endl;
+    }
+    else
+    {
+        if(scene.init(1 + ndots))
+            return -1;
+        
+        scene.begin();
+        scene.add(bar);
+        for(size_t i=0; i<ndots; i++)
+            scene.add(dots[i]);
+        scene.end();
+        
+        std::cout<<scene.count<<" scene instances"<<(scene.persistent ? ", persistently mapped" : "")<<std::endl;
+    }
 
     //
     GLuint vs;
+    GLuint gs;
     GLuint fs;
     GLuint shaderProgram;
   
@@ -351,6 +1103,15 @@ int main(int argc, char *argv[])
         return -1;
     }
     
+    gs = glCreateShader(GL_GEOMETRY_SHADER);
+    glShaderSource(gs, 1, &gsScene, NULL);
+    glCompileShader(gs);
+    if(check_shader_compile_status(gs)==false)
+    {
+        std::cout<<"Fail to compile geometry shader"<<std::endl;
+        return -1;
+    }
+    
     fs = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fs, 1, &fragmentShader, NULL);
     glCompileShader(fs);
@@ -363,60 +1124,96 @@ int main(int argc, char *argv[])
     //
     shaderProgram = glCreateProgram();
     glAttachShader(shaderProgram, vs);
+    glAttachShader(shaderProgram, gs);
     glAttachShader(shaderProgram, fs);
     glLinkProgram(shaderProgram);
+    if(check_program_link_status(shaderProgram)==false)
+    {
+        std::cout<<"Fail to link scene program"<<std::endl;
+        return -1;
+    }
     
     GLuint mvp_location = glGetUniformLocation(shaderProgram, "MVP");
-    GLuint pos_location = glGetAttribLocation(shaderProgram, "vPos");
-    //GLuint col_location = glGetUniformLocation(shaderProgram, "uniColor");
-    //glUniform4fv(col_location, 1, glm::value_ptr(rect.color)); // color
+    GLuint time_location = glGetUniformLocation(shaderProgram, "time");
+    GLuint dt_location = glGetUniformLocation(shaderProgram, "dt");
+    GLuint extent_location = glGetUniformLocation(shaderProgram, "extent");
+    GLuint layers_location = glGetUniformLocation(shaderProgram, "layers");
     
-    //cout<<glm::to_string(mvp)<<endl;
     
-    // vao
-    GLuint vao=0, vbo=0;
+    // fb
+    glGenTextures(NTEX, textures);
     
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray( vao );
+    // the panorama, not needed in direct mode
+    GLuint fb=0;
+    if(!b_direct)
+    {
+        glGenFramebuffers(1, &fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, fb);
     
-    glGenBuffers(1, &vbo);
-    glBindBuffer( GL_ARRAY_BUFFER, vbo );
-    glBufferData( GL_ARRAY_BUFFER, sizeof(glm::vec2)*rect.positions.size(), &(rect.positions[0]), GL_STATIC_DRAW );
+        // one layer per subframe, a loaded image goes to all of them
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[PJTEX]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, roi.w, roi.h, subframes, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        if(image)
+        {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, dimx);
+            for(size_t k=0; k<npieces; k++)
+            {
+                glPixelStorei(GL_UNPACK_SKIP_PIXELS, pieces[k].x);
+                glPixelStorei(GL_UNPACK_SKIP_ROWS, pieces[k].y);
+                for(size_t i=0; i<subframes; i++)
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, pieces[k].dx, 0, i, pieces[k].w, pieces[k].h, 1,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, image);
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        }
     
-    glEnableVertexAttribArray( pos_location );
-    glVertexAttribPointer( pos_location, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(0) );
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        // the panorama is a cylinder: taps past column 0 or dimx wrap around
+        // it when the region is the full width (a narrower region is already
+        // contiguous across the seam and never sampled at its edges)
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     
-    glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[PJDEPTH]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, roi.w, roi.h, subframes, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
     
-    // fb
-    GLuint fb=0, db=0;
-    glGenFramebuffers(1, &fb);
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-    
-    glBindTexture(GL_TEXTURE_2D, textures[PJTEX]);
-    //glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, dimx, dimy, 0, GL_RED, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, dimx, dimy, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+        // layered, gl_Layer picks the subframe
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textures[PJTEX], 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[PJDEPTH], 0);
     
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[PJTEX], 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n";
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    
+    // output fb, the warp renders here; it is read back from here and
+    // blitted to the window
+    GLuint fbOut=0;
+    glGenFramebuffers(1, &fbOut);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbOut);
     
-    glGenRenderbuffers(1, &db);
-    glBindRenderbuffer(GL_RENDERBUFFER, db);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, dimx, dimy);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, textures[OUTTEX]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
     
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, db);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[OUTTEX], 0);
     
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
     {
-        std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n";
+        std::cout << "ERROR::FRAMEBUFFER:: Output framebuffer is not complete!\n";
     }
-
+    
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
     //
@@ -425,6 +1222,7 @@ int main(int argc, char *argv[])
     
     //
     GLuint vsDeform;
+    GLuint gsDeform;
     GLuint fsDeform;
     GLuint spDeform;
     
@@ -437,6 +1235,15 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    gsDeform = glCreateShader(GL_GEOMETRY_SHADER);
+    glShaderSource(gsDeform, 1, &gsLayer, NULL);
+    glCompileShader(gsDeform);
+    if(check_shader_compile_status(gsDeform)==false)
+    {
+        std::cout<<"Fail to compile screen geometry shader"<<std::endl;
+        return -1;
+    }
+
     fsDeform = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fsDeform, 1, &fsWarp, NULL);
     glCompileShader(fsDeform);
@@ -449,14 +1256,21 @@ int main(int argc, char *argv[])
     //
     spDeform = glCreateProgram();
     glAttachShader(spDeform, vsDeform);
+    glAttachShader(spDeform, gsDeform);
     glAttachShader(spDeform, fsDeform);
     glLinkProgram(spDeform);
+    if(check_program_link_status(spDeform)==false)
+    {
+        std::cout<<"Fail to link warp program"<<std::endl;
+        return -1;
+    }
 
     GLuint locPos = glGetAttribLocation(spDeform, "vPos");
     GLuint locTex0  = glGetUniformLocation(spDeform, "tex0");
     GLuint locTex1  = glGetUniformLocation(spDeform, "tex1");
     GLuint locWidth  = glGetUniformLocation(spDeform, "w");
     GLuint locHeight  = glGetUniformLocation(spDeform, "h");
+    ProjectorUniforms uniDeform = projectorUniforms(spDeform);
 
     // screen quad
     static const GLfloat quad[] = {
@@ -483,32 +1297,442 @@ int main(int argc, char *argv[])
     glBindVertexArray(0);
     
     //
+    glUseProgram(spDeform);
     glUniform1f(locWidth, dimx);
     glUniform1f(locHeight, dimy);
+    glUniform4f(glGetUniformLocation(spDeform, "roi"), roi.x, roi.y, roi.w, roi.h);
+    glUseProgram(0);
+    
+    // mesh mode: the deformation texture is only used to build the meshes,
+    // one per projector, back to back in one buffer
+    WarpMesh mesh;
+    std::vector<float> meshVertices;
+    std::vector<uint32_t> meshIndices;
+    GLuint vsGrid=0, gsGrid=0, fsGrid=0;
+    GLuint spMesh=0;
+    GLuint vaoMesh=0, vboMesh=0, iboMesh=0;
+    ProjectorUniforms uniMesh = {-1, -1, -1, -1, -1, -1};
     
+    if(meshStep)
+    {
+        for(size_t k=0; k<nprojectors; k++)
+        {
+            if(mesh.build(rig.projectors[k].deform, meshStep, meshError))
+                return -1;
+            
+            std::cout<<"mesh of "<<mesh.cells<<" cells, "<<mesh.bytes()/1024<<" KB, error max "<<mesh.maxError
+                     <<" rms "<<mesh.rmsError<<" px"<<std::endl;
+            
+            // 4 floats per vertex
+            uint32_t base = meshVertices.size()/4;
+            warps[k].meshFirst = meshIndices.size();
+            warps[k].meshCount = mesh.indices.size();
+            meshVertices.insert(meshVertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            for(size_t i=0; i<mesh.indices.size(); i++)
+                meshIndices.push_back(base + mesh.indices[i]);
+        }
+        
+        const char *sources[3] = {vsMesh, gsMesh, fsMesh};
+        GLenum types[3] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER};
+        GLuint *shaders[3] = {&vsGrid, &gsGrid, &fsGrid};
+        
+        spMesh = glCreateProgram();
+        for(int i=0; i<3; i++)
+        {
+            *shaders[i] = glCreateShader(types[i]);
+            glShaderSource(*shaders[i], 1, &sources[i], NULL);
+            glCompileShader(*shaders[i]);
+            if(check_shader_compile_status(*shaders[i])==false)
+            {
+                std::cout<<"Fail to compile mesh shader"<<std::endl;
+                return -1;
+            }
+            glAttachShader(spMesh, *shaders[i]);
+        }
+        glLinkProgram(spMesh);
+        if(check_program_link_status(spMesh)==false)
+        {
+            std::cout<<"Fail to link mesh program"<<std::endl;
+            return -1;
+        }
+        
+        glUseProgram(spMesh);
+        glUniform1i(glGetUniformLocation(spMesh, "tex0"), 0);
+        glUniform1f(glGetUniformLocation(spMesh, "w"), dimx);
+        glUniform1f(glGetUniformLocation(spMesh, "h"), dimy);
+        glUniform4f(glGetUniformLocation(spMesh, "roi"), roi.x, roi.y, roi.w, roi.h);
+        glUseProgram(0);
+        uniMesh = projectorUniforms(spMesh);
+        
+        glGenVertexArrays(1, &vaoMesh);
+        glBindVertexArray(vaoMesh);
+        
+        glGenBuffers(1, &vboMesh);
+        glBindBuffer(GL_ARRAY_BUFFER, vboMesh);
+        glBufferData(GL_ARRAY_BUFFER, meshVertices.size()*sizeof(float), meshVertices.empty() ? NULL : &meshVertices[0],
+                     GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (GLvoid*)(2*sizeof(float)));
+        
+        glGenBuffers(1, &iboMesh);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboMesh);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshIndices.size()*sizeof(uint32_t), meshIndices.empty() ? NULL : &meshIndices[0],
+                     GL_STATIC_DRAW);
+        
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // direct mode: the scene is evaluated in the warp itself
+    GLuint fsProc=0;
+    GLuint spDirect=0;
+    GLuint locDirectTime=0, locDirectDt=0, locDirectCount=0;
+    ProjectorUniforms uniDirect = {-1, -1, -1, -1, -1, -1};
+    
+    if(b_direct)
+    {
+        fsProc = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fsProc, 1, &fsDirect, NULL);
+        glCompileShader(fsProc);
+        if(check_shader_compile_status(fsProc)==false)
+        {
+            std::cout<<"Fail to compile direct fragment shader"<<std::endl;
+            return -1;
+        }
+        
+        spDirect = glCreateProgram();
+        glAttachShader(spDirect, vsDeform);
+        glAttachShader(spDirect, gsDeform);
+        glAttachShader(spDirect, fsProc);
+        glBindAttribLocation(spDirect, locPos, "vPos");
+        glLinkProgram(spDirect);
+        if(check_program_link_status(spDirect)==false)
+        {
+            std::cout<<"Fail to link direct program"<<std::endl;
+            return -1;
+        }
+        
+        locDirectTime = glGetUniformLocation(spDirect, "time");
+        locDirectDt = glGetUniformLocation(spDirect, "dt");
+        locDirectCount = glGetUniformLocation(spDirect, "count");
+        glUniformBlockBinding(spDirect, glGetUniformBlockIndex(spDirect, "Primitives"), 0);
+        
+        glUseProgram(spDirect);
+        glUniform1i(glGetUniformLocation(spDirect, "tex1"), 1);
+        glUniform2f(glGetUniformLocation(spDirect, "extent"), dimx, dimy);
+        glUniform3f(glGetUniformLocation(spDirect, "background"), 0.5f, 0.5f, 0.5f); // clear color of the scene
+        glUseProgram(0);
+        uniDirect = projectorUniforms(spDirect);
+    }
+    
+    // straight from the mapped files, in their encoding, a layer per
+    // projector; the array is bound once and every warp picks its layer
+    GLenum dmFormat = GL_RG32F, dmType = GL_FLOAT;
+    if(rig.projectors[0].deform.type == DEFORM_RG16F)
+    {
+        dmFormat = GL_RG16F;
+        dmType = GL_HALF_FLOAT;
+    }
+    else if(rig.projectors[0].deform.type == DEFORM_RG16)
+    {
+        dmFormat = GL_RG16;
+        dmType = GL_UNSIGNED_SHORT;
+    }
+    
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textures[DMTEX]);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, dmFormat, rig.maxWidth, rig.maxHeight, nprojectors, 0, GL_RG, dmType, NULL);
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        const DeformMap &deform = rig.projectors[k].deform;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, k, deform.width, deform.height, 1, GL_RG, dmType, deform.data);
+    }
+    
+    // fetched per texel, the sentinel must never be filtered
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    
+    // photometric correction in the warp pass: the gains as RG16, gain in
+    // R, and the tables of photometric.h, both fetched per texel. the
+    // projectors of a rig share one gamma, one without gains is not
+    // corrected
+    Photometric photometric;
+    const DeformMap *gained = NULL;
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        const DeformMap &deform = rig.projectors[k].deform;
+        if(deform.gain == NULL)
+            continue;
+        if(gained && gained->gamma != deform.gamma)
+        {
+            std::cout<<"the projectors of a rig need one gamma, not "<<gained->gamma<<" and "<<deform.gamma<<std::endl;
+            return -1;
+        }
+        gained = &deform;
+    }
+    
+    if(gained)
+    {
+        photometric.init(gained->gamma);
+        std::cout<<"photometric correction, gamma "<<gained->gamma<<std::endl;
+        
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[GAINTEX]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG16, rig.maxWidth, rig.maxHeight, nprojectors, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+        for(size_t k=0; k<nprojectors; k++)
+        {
+            const DeformMap &deform = rig.projectors[k].deform;
+            if(deform.gain)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, k, deform.width, deform.height, 1, GL_RG, GL_UNSIGNED_SHORT,
+                                deform.gain);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        
+        std::vector<float> tables(2*PHOTO_LEVELS, 0.0f);
+        for(size_t i=0; i<256; i++)
+            tables[i] = photometric.decode[i];
+        for(size_t i=0; i<PHOTO_LEVELS; i++)
+            tables[PHOTO_LEVELS + i] = photometric.encode[i] / 255.0f;
+        
+        glBindTexture(GL_TEXTURE_2D, textures[GAMMATEX]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, PHOTO_LEVELS, 2, 0, GL_RED, GL_FLOAT, &tables[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    GLuint photoPrograms[2] = {spDeform, spMesh};
+    for(int i=0; i<2; i++)
+    {
+        if(photoPrograms[i] == 0)
+            continue;
+        glUseProgram(photoPrograms[i]);
+        glUniform1i(glGetUniformLocation(photoPrograms[i], "tex2"), 2);
+        glUniform1i(glGetUniformLocation(photoPrograms[i], "tex3"), 3);
+    }
+    glUseProgram(0);
+    
+    //
+    //---- pattern mode: subframes are warped into the layers of SUBTEX and
+    //     packed into the bit planes of OUTTEX
     //
-    float * deformMat = NULL;
-    loadDeform((char*)(deformMat), deformFile);
+    GLuint fbSub=0;
+    GLuint fsBits=0;
+    GLuint spPack=0;
+    GLuint locPlanes=0, locBits=0, locSub=0;
+    Dither ditherTile;
     
-    glBindTexture(GL_TEXTURE_2D, textures[DMTEX]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, deformMat);
+    if(planes)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[SUBTEX]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, planes, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        
+        // layered, the warp writes all subframes in one draw
+        glGenFramebuffers(1, &fbSub);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbSub);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textures[SUBTEX], 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER:: Subframe framebuffer is not complete!\n";
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        
+        fsBits = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fsBits, 1, &fsPack, NULL);
+        glCompileShader(fsBits);
+        if(check_shader_compile_status(fsBits)==false)
+        {
+            std::cout<<"Fail to compile packing fragment shader"<<std::endl;
+            return -1;
+        }
+        
+        // shares the screen quad of the warp
+        spPack = glCreateProgram();
+        glAttachShader(spPack, vsDeform);
+        glAttachShader(spPack, fsBits);
+        glBindAttribLocation(spPack, locPos, "vPos");
+        glLinkProgram(spPack);
+        if(check_program_link_status(spPack)==false)
+        {
+            std::cout<<"Fail to link packing program"<<std::endl;
+            return -1;
+        }
+        
+        locSub = glGetUniformLocation(spPack, "tex0");
+        locPlanes = glGetUniformLocation(spPack, "planes");
+        locBits = glGetUniformLocation(spPack, "bits");
+        
+        glUseProgram(spPack);
+        glUniform1i(locSub, 0);
+        glUniform1i(locPlanes, planes);
+        glUniform1i(locBits, 24/planes);
+        glUniform1i(glGetUniformLocation(spPack, "tex1"), 1);
+        glUniform1i(glGetUniformLocation(spPack, "dither"), dither != DITHER_NONE);
+        glUseProgram(0);
+        
+        // the threshold tile as bytes, fetched with wrapped coordinates
+        if(dither != DITHER_NONE)
+        {
+            if(ditherTile.init(dither))
+                return -1;
+            std::cout<<Dither::name(dither)<<" dither of the bit planes"<<std::endl;
+            
+            size_t n = ditherTile.size;
+            std::vector<uint8_t> tile(n*n);
+            for(size_t y=0; y<n; y++)
+                for(size_t x=0; x<n; x++)
+                    tile[y*n + x] = (uint8_t)ditherTile.threshold[y*ditherTile.stride + x];
+            
+            glBindTexture(GL_TEXTURE_2D, textures[DITHERTEX]);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, n, n, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &tile[0]);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    //
+    //---- validity: the warp draws only the quadtree blocks with valid
+    //     pixels, and a stencil written once rejects the pixels without
+    //     source inside them before they are shaded
+    //
+    // to clip space of each projector's viewport; memory rows are
+    // gl_FragCoord rows
+    std::vector<GLfloat> blocks;
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        const DeformMap &deform = rig.projectors[k].deform;
+        ValidityMask validity;
+        if(validity.build(deform))
+        {
+            return -1;
+        }
+        
+        std::vector<ValidityMask::Rect> rects;
+        validity.regions(rects);
+        
+        float w = deform.width, h = deform.height;
+        for(size_t i=0; i<rects.size(); i++)
+        {
+            GLfloat x0 = 2.0f*rects[i].x/w - 1.0f, x1 = 2.0f*(rects[i].x + rects[i].w)/w - 1.0f;
+            GLfloat y0 = 2.0f*rects[i].y/h - 1.0f, y1 = 2.0f*(rects[i].y + rects[i].h)/h - 1.0f;
+            GLfloat v[] = { x0, y0, x1, y0, x1, y1, x0, y0, x1, y1, x0, y1 };
+            blocks.insert(blocks.end(), v, v + 12);
+        }
+        warps[k].first = blocks.size()/2 - 6*rects.size();
+        warps[k].count = 6*rects.size();
+        
+        std::cout<<validity.count<<" valid pixels in "<<rects.size()<<" blocks"<<std::endl;
+    }
     
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLuint vaoValid=0, vboValid=0;
+    glGenVertexArrays(1, &vaoValid);
+    glBindVertexArray(vaoValid);
+    
+    glGenBuffers(1, &vboValid);
+    glBindBuffer(GL_ARRAY_BUFFER, vboValid);
+    glBufferData(GL_ARRAY_BUFFER, blocks.size()*sizeof(GLfloat), blocks.empty() ? NULL : &blocks[0], GL_STATIC_DRAW);
+    
+    glEnableVertexAttribArray( locPos );
+    glVertexAttribPointer( locPos, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(0) );
+    
+    glBindVertexArray(0);
+    
+    GLuint fbWarp = planes ? fbSub : fbOut;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbWarp);
+    
+    if(planes)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[WARPSTENCIL]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH24_STENCIL8, width, height, planes, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, textures[WARPSTENCIL], 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, textures[WARPSTENCIL]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, textures[WARPSTENCIL], 0);
+    }
+    
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "ERROR::FRAMEBUFFER:: Warp framebuffer with stencil is not complete!\n";
+    }
+    
+    GLuint fsStencil = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fsStencil, 1, &fsMask, NULL);
+    glCompileShader(fsStencil);
+    if(check_shader_compile_status(fsStencil)==false)
+    {
+        std::cout<<"Fail to compile stencil fragment shader"<<std::endl;
+        return -1;
+    }
+    
+    GLuint spStencil = glCreateProgram();
+    glAttachShader(spStencil, vsDeform);
+    glAttachShader(spStencil, gsDeform);
+    glAttachShader(spStencil, fsStencil);
+    glBindAttribLocation(spStencil, locPos, "vPos");
+    glLinkProgram(spStencil);
+    if(check_program_link_status(spStencil)==false)
+    {
+        std::cout<<"Fail to link stencil program"<<std::endl;
+        return -1;
+    }
+    
+    glUseProgram(spStencil);
+    glUniform1i(glGetUniformLocation(spStencil, "tex1"), 1);
+    ProjectorUniforms uniStencil = projectorUniforms(spStencil);
+    
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textures[DMTEX]);
+    
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    
+    glBindVertexArray(vaoValid);
+    for(size_t k=0; k<nprojectors; k++)
+    {
+        useProjector(uniStencil, rig, k, warps[k]);
+        glDrawArraysInstanced(GL_TRIANGLES, warps[k].first, warps[k].count, subframes);
+    }
+    glBindVertexArray(0);
+    
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_STENCIL_TEST);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
     //
     //---- screen
     //
     
     //
-    GLuint vsScn;
-    GLuint fsScn;
-    GLuint spScn;
-    GLuint pos_loc, tex_loc;
+    GLuint vsScn=0;
+    GLuint fsScn=0;
+    GLuint spScn=0;
+    GLuint pos_loc=0, tex_loc=0;
     GLuint vaoScn=0, vboScn=0;
     
     if(b_debug)
@@ -568,39 +1792,79 @@ int main(int argc, char *argv[])
     //
     //---- Warp
     //
-    while (!glfwWindowShouldClose (window))
+    PassTimer timeScene, timeWarp, timePack;
+    timeScene.init();
+    timeWarp.init();
+    timePack.init();
+    
+    // every warped frame is read back and archived by the recorder thread
+    Recorder recorder;
+    Readback readback;
+    if(b_record)
+    {
+        if(recorder.open(outFile, width, height))
+            return -1;
+        if(readback.init(width, height, recordFrame, &recorder))
+            return -1;
+    }
+    
+    size_t frame = 0;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    
+    while (b_headless ? frame < nframes : !glfwWindowShouldClose (window))
     {
         //
-        glfwPollEvents();
+        if(!b_headless)
+            glfwPollEvents();
         
         //
-        //------ 1st Pass: render an input image to a framebuffer
+        //------ 1st Pass: render an input image to a framebuffer,
+        //                 unless an image was loaded into it or
+        //                 the scene is rendered directly
         //
+        if(image == NULL && !b_direct)
+        {
+            timeScene.begin();
         
-        // render to texture
-        //glBindFramebuffer(GL_FRAMEBUFFER, fb);
-        //glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glViewport(0, 0, dimx, dimy);
-        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
-        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            // render to texture, the source region only
+            glBindFramebuffer(GL_FRAMEBUFFER, fb);
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            glViewport(0, 0, roi.w, roi.h);
+            glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
-        //
-        glEnable(GL_TEXTURE_2D);
-        glEnable(GL_DEPTH_TEST);
-        //glDepthFunc(GL_LESS);
-        //glEnable(GL_CULL_FACE);
+            //
+            glEnable(GL_DEPTH_TEST);
+            //glDepthFunc(GL_LESS);
+            //glEnable(GL_CULL_FACE);
         
-        glUseProgram(shaderProgram);
+            glUseProgram(shaderProgram);
         
-        //glDrawBuffers(2, g_drawBuffers);
+            //glDrawBuffers(2, g_drawBuffers);
 
-        //
-        glUniformMatrix4fv(mvp_location, 1, GL_FALSE, glm::value_ptr(mvp));
+            //
+            glUniform2f(extent_location, dimx, dimy);
+            glUniform1i(layers_location, subframes);
+            
+            // the only per-frame input of the scene; pattern mode shows
+            // subframe i at frame + i/planes
+            glUniform1f(time_location, frame / refresh);
+            glUniform1f(dt_location, 1.0 / (refresh * subframes));
         
-        //
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
+            // every shape once per subframe, each into its own layer;
+            // a region across the seam is drawn as its two pieces
+            glEnable(GL_SCISSOR_TEST);
+            for(size_t i=0; i<npieces; i++)
+            {
+                glViewport(pieces[i].dx, 0, pieces[i].w, pieces[i].h);
+                glScissor(pieces[i].dx, 0, pieces[i].w, pieces[i].h);
+                glUniformMatrix4fv(mvp_location, 1, GL_FALSE, glm::value_ptr(pieceMVP[i]));
+                scene.draw(subframes);
+            }
+            glDisable(GL_SCISSOR_TEST);
+        
+            timeScene.end();
+        }
 
         // pixel transfer
 //        GLubyte pixels[dimx*dimy*4];
@@ -612,107 +1876,228 @@ int main(int argc, char *argv[])
         {
             //
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
-//            //glDrawBuffer(GL_BACK_LEFT);
-//            //glViewport(0, 0, dimx, dimy);
-//            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-//            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-//            glDisable(GL_DEPTH_TEST);
-//
-//            //
-//            glUseProgram(spScn);
-//            glActiveTexture(GL_TEXTURE0);
-//            glBindTexture(GL_TEXTURE_2D, textures[PJTEX]);
-//            glUniform1i(tex_loc, 0);
-//            
-//            //
-//            glBindVertexArray(vaoScn);
-//            glDrawArrays(GL_TRIANGLES, 0, 6);
-//            glBindVertexArray(0);
+            glViewport(0, 0, dimx, dimy);
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glDisable(GL_DEPTH_TEST);
+
+            //
+            glUseProgram(spScn);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textures[PJTEX]);
+            glUniform1i(tex_loc, 0);
+            
+            //
+            glBindVertexArray(vaoScn);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            glBindVertexArray(0);
         }
         else
         {
             //
-            //---- 2nd pass: load deformation into deform texture (sampler2D)
+            //---- 2nd pass: warp the panorama through the deformation texture,
+            //                all subframes at once
             //
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            timeWarp.begin();
+            
+            glBindFramebuffer(GL_FRAMEBUFFER, fbWarp);
             glViewport(0, 0, width, height);
-            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // pixels without source are not drawn
+            glClear( GL_COLOR_BUFFER_BIT);
+            glDisable(GL_DEPTH_TEST);
             
-            //
-            glUseProgram(spDeform);
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_EQUAL, 1, 0xff);
             
             //
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textures[PJTEX]);
-            glUniform1i(locTex0, 0);
+            const ProjectorUniforms *uni = &uniDeform;
+            if(b_direct)
+            {
+                uni = &uniDirect;
+                glUseProgram(spDirect);
+                glUniform1f(locDirectTime, frame / refresh);
+                glUniform1f(locDirectDt, 1.0 / (refresh * subframes));
+                glUniform1i(locDirectCount, procedural.primitives.size());
+                procedural.bind();
+            }
+            else if(meshStep)
+            {
+                uni = &uniMesh;
+                glUseProgram(spMesh);
+                
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textures[PJTEX]);
+            }
+            else
+            {
+                glUseProgram(spDeform);
+                
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textures[PJTEX]);
+                glUniform1i(locTex0, 0);
+                glUniform1i(locTex1, 1);
+            }
             
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, textures[DMTEX]);
-            glUniform1i(locTex1, 1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textures[DMTEX]);
+            
+            if(gained)
+            {
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textures[GAINTEX]);
+                glActiveTexture(GL_TEXTURE3);
+                glBindTexture(GL_TEXTURE_2D, textures[GAMMATEX]);
+            }
 
-            //
-            glBindVertexArray(vaoDeform);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            // one panorama, a warp per projector
+            glBindVertexArray(meshStep ? vaoMesh : vaoValid);
+            for(size_t k=0; k<nprojectors; k++)
+            {
+                useProjector(*uni, rig, k, warps[k]);
+                if(meshStep)
+                    glDrawElementsInstanced(GL_TRIANGLES, warps[k].meshCount, GL_UNSIGNED_INT,
+                                            (GLvoid*)(warps[k].meshFirst*sizeof(uint32_t)), subframes);
+                else
+                    glDrawArraysInstanced(GL_TRIANGLES, warps[k].first, warps[k].count, subframes);
+            }
             glBindVertexArray(0);
+            glDisable(GL_STENCIL_TEST);
+            
+            timeWarp.end();
+            
+            //
+            //---- 3rd pass: pack the subframes into the bit planes
+            //
+            if(planes)
+            {
+                timePack.begin();
+                
+                glBindFramebuffer(GL_FRAMEBUFFER, fbOut);
+                glViewport(0, 0, width, height);
+                
+                glUseProgram(spPack);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textures[SUBTEX]);
+                if(dither != DITHER_NONE)
+                {
+                    glActiveTexture(GL_TEXTURE1);
+                    glBindTexture(GL_TEXTURE_2D, textures[DITHERTEX]);
+                    glActiveTexture(GL_TEXTURE0);
+                }
+                
+                glBindVertexArray(vaoDeform);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                glBindVertexArray(0);
+                
+                timePack.end();
+            }
+            
+            //
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbOut);
+            if(b_record)
+                readback.read(frame, Recorder::now());
+            
+            if(!b_headless)
+            {
+                int fb_width, fb_height;
+                glfwGetFramebufferSize(window, &fb_width, &fb_height);
+                
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+                glBlitFramebuffer(0, 0, width, height, 0, 0, fb_width, fb_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
         
-        //
-        glfwSwapBuffers(window);
+        // no vsync without a window, just keep the driver queue moving
+        if(b_headless)
+            glFlush();
+        else
+            glfwSwapBuffers(window);
+        
+        // GPU cost per pass, about once a second at 360 Hz
+        if(++frame % 360 == 0)
+        {
+            if(planes)
+                printf("frame %zu: scene %.3f ms, warp %.3f ms, pack %.3f ms\n", frame, timeScene.ms(), timeWarp.ms(), timePack.ms());
+            else
+                printf("frame %zu: scene %.3f ms, warp %.3f ms\n", frame, timeScene.ms(), timeWarp.ms());
+            timeScene.reset();
+            timeWarp.reset();
+            timePack.reset();
+        }
     }
     
-    //
-    //---- save output image
-    //
-    GLfloat *texData = NULL;
-    
-    try
-    {
-        texData = new GLfloat[dimx*dimy];
-    }
-    catch(...)
-    {
-        std::cout<<"Fail to allocate memory for texture data"<<std::endl;
-        return -1;
-    }
+    glFinish();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    printf("%zu frames in %.3f s, %.1f frames/s\n", frame, elapsed, frame/elapsed);
     
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textures[PJTEX]);
-    glUniform1i(locTex0, 0);
+    timeScene.release();
+    timeWarp.release();
+    timePack.release();
     
     //
-    FILE *fp=NULL;
-    fp = fopen(outFile, "w");
-    
-    if (fp == NULL) {
-        std::cout<<"Can't open output file %s!\n";
-        return -1;
+    //---- save output images
+    //
+    if(b_record)
+    {
+        readback.collect(true);
+        readback.release();
+        recorder.close();
+        
+        std::cout<<recorder.written<<" frames written to "<<outFile<<", "<<recorder.dropped<<" dropped"
+                 <<(recorder.failed ? ", stopped by a failed write" : "")<<std::endl;
     }
     
-    for(size_t i=0; i<dimx*dimy; i++)
-        fprintf(fp, "%f", texData[i]);
-    
-    fclose(fp);
-    
     //
     //---- release resources
     //
     
     //
+    scene.release();
+    procedural.release();
     glDeleteProgram(shaderProgram);
     glDeleteShader(fs);
+    glDeleteShader(gs);
     glDeleteShader(vs);
 
     glDeleteProgram(spDeform);
     glDeleteShader(fsDeform);
+    glDeleteShader(gsDeform);
     glDeleteShader(vsDeform);
     
-    glDeleteTextures(2, textures);
+    glDeleteTextures(NTEX, textures);
     glDeleteFramebuffers(1, &fb);
-    glDeleteRenderbuffers(1, &db);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
+    glDeleteFramebuffers(1, &fbOut);
     glDeleteBuffers(1, &vboDeform);
     glDeleteVertexArrays(1, &vaoDeform);
+    glDeleteBuffers(1, &vboValid);
+    glDeleteVertexArrays(1, &vaoValid);
+    glDeleteProgram(spStencil);
+    glDeleteShader(fsStencil);
+    
+    if(meshStep)
+    {
+        glDeleteProgram(spMesh);
+        glDeleteShader(vsGrid);
+        glDeleteShader(gsGrid);
+        glDeleteShader(fsGrid);
+        glDeleteBuffers(1, &vboMesh);
+        glDeleteBuffers(1, &iboMesh);
+        glDeleteVertexArrays(1, &vaoMesh);
+    }
+    
+    if(b_direct)
+    {
+        glDeleteProgram(spDirect);
+        glDeleteShader(fsProc);
+    }
+    
+    if(planes)
+    {
+        glDeleteProgram(spPack);
+        glDeleteShader(fsBits);
+        glDeleteFramebuffers(1, &fbSub);
+    }
     
     if(b_debug)
     {
@@ -723,20 +2108,14 @@ int main(int argc, char *argv[])
         glDeleteVertexArrays(1, &vaoScn);
     }
     
-    if(deformMat)
-    {
-        delete []deformMat;
-        deformMat = NULL;
-    }
-    
-    if(texData)
-    {
-        delete []texData;
-        texData = NULL;
-    }
+    rig.release();
+    stbi_image_free(image);
 
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    if(b_headless)
+        destroyHeadlessContext();
+    else
+        glfwTerminate();
     exit(EXIT_SUCCESS);
 }
 
@@ -0,0 +1,407 @@
+// deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "deform.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+using namespace std;
+
+// p lies in the file mapping of dm
+static bool inMap(const DeformMap &dm, const void *p)
+{
+    return dm.map && (const char*)p >= (const char*)dm.map && (const char*)p < (const char*)dm.map + dm.mapSize;
+}
+
+DeformMap::DeformMap()
+{
+    data = NULL;
+    p = NULL;
+    width = 0;
+    height = 0;
+    sentinel = -1.0f;
+    type = DEFORM_RG32F;
+    scale[0] = scale[1] = 1.0f;
+    gain = NULL;
+    gamma = 2.2f;
+    map = NULL;
+    mapSize = 0;
+}
+
+DeformMap::~DeformMap()
+{
+    release();
+}
+
+void DeformMap::release()
+{
+    // gains are in the mapping if they came with the file
+    if(gain && !inMap(*this, gain))
+        delete []gain;
+    gain = NULL;
+
+    if(map)
+    {
+        munmap(map, mapSize);
+        map = NULL;
+        mapSize = 0;
+    }
+    else if(data)
+    {
+        delete [](char*)data;
+    }
+    data = NULL;
+    p = NULL;
+    width = height = 0;
+}
+
+uint16_t floatToHalf(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if(bits >= 0x7f800000) // inf and nan
+        return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+    if(bits >= 0x477ff000) // rounds past 65504
+        return sign | 0x7c00;
+    if(bits < 0x38800000) // denormal: the rounding is done by the add
+    {
+        float a;
+        memcpy(&a, &bits, 4);
+        a += 0.5f;
+        memcpy(&bits, &a, 4);
+        return sign | (uint16_t)(bits - 0x3f000000);
+    }
+
+    // rebias and round the 13 dropped bits to nearest even
+    uint32_t odd = (bits >> 13) & 1;
+    bits += 0xc8000fff + odd; // (15-127)<<23 + 0xfff
+    return sign | (uint16_t)(bits >> 13);
+}
+
+uint32_t deformType(const char *name)
+{
+    if(strcmp(name, "rg32f") == 0)
+        return DEFORM_RG32F;
+    if(strcmp(name, "rg16f") == 0)
+        return DEFORM_RG16F;
+    if(strcmp(name, "rg16") == 0)
+        return DEFORM_RG16;
+    return 0;
+}
+
+const char* deformTypeName(uint32_t type)
+{
+    switch(type)
+    {
+    case DEFORM_RG32F: return "rg32f";
+    case DEFORM_RG16F: return "rg16f";
+    case DEFORM_RG16: return "rg16";
+    }
+    return "unknown";
+}
+
+// crc32 (zlib polynomial)
+uint32_t deformChecksum(const void *data, size_t size)
+{
+    uint32_t table[256];
+    for(uint32_t i=0; i<256; i++)
+    {
+        uint32_t c = i;
+        for(int k=0; k<8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : (c >> 1);
+        table[i] = c;
+    }
+
+    const unsigned char *b = (const unsigned char*)data;
+    uint32_t crc = 0xffffffff;
+    for(size_t i=0; i<size; i++)
+        crc = table[(crc ^ b[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+int loadDeform(DeformMap &dm, string fn, size_t w, size_t h, bool verify)
+{
+    int fd = open(fn.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cout<<"Fail to open deformation "<<fn<<std::endl;
+        return -1;
+    }
+
+    struct stat sb;
+    if(fstat(fd, &sb) < 0 || sb.st_size == 0)
+    {
+        std::cout<<"Fail to stat deformation "<<fn<<std::endl;
+        close(fd);
+        return -1;
+    }
+    size_t size = sb.st_size;
+
+    // private, writable mapping: pages are shared with the page cache until
+    // someone writes to them
+    void *map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED)
+    {
+        std::cout<<"Fail to map deformation "<<fn<<std::endl;
+        return -1;
+    }
+
+    DeformHeader header;
+    size_t offset = 0;
+
+    if(size >= sizeof(DeformHeader) && memcmp(map, DEFORM_MAGIC, 4) == 0)
+    {
+        memcpy(&header, map, sizeof(DeformHeader));
+
+        // version 1 is RG32F without a scale, before 3 there are no gains
+        if(header.version == 1)
+        {
+            header.scale[0] = header.scale[1] = 1.0f;
+        }
+        if(header.version < 3)
+        {
+            header.gainOffset = 0;
+            header.gamma = 2.2f;
+        }
+
+        if(header.version < 1 || header.version > DEFORM_VERSION
+           || (header.version == 1 && header.type != DEFORM_RG32F)
+           || header.type < DEFORM_RG32F || header.type > DEFORM_RG16
+           || header.offset % DEFORM_ALIGN || header.offset + header.size > size
+           || header.size != deformPixelSize(header.type)*header.width*header.height
+           || header.gainOffset % DEFORM_ALIGN
+           || (header.gainOffset && header.gainOffset + sizeof(uint32_t)*header.width*header.height > size))
+        {
+            std::cout<<"Unsupported or corrupt deformation header in "<<fn<<std::endl;
+            munmap(map, size);
+            return -1;
+        }
+
+        offset = header.offset;
+        w = header.width;
+        h = header.height;
+
+        if(verify && (deformChecksum((char*)map + offset, header.size) != header.checksum
+                      || (header.gainOffset && deformChecksum((char*)map + header.gainOffset,
+                                                              sizeof(uint32_t)*w*h) != header.gainChecksum)))
+        {
+            std::cout<<"Checksum mismatch in deformation "<<fn<<std::endl;
+            munmap(map, size);
+            return -1;
+        }
+    }
+    else
+    {
+        // raw RG32F
+        if(size != 2*sizeof(float)*w*h)
+        {
+            std::cout<<"Deformation "<<fn<<" has "<<size<<" bytes, expect "<<2*sizeof(float)*w*h<<std::endl;
+            munmap(map, size);
+            return -1;
+        }
+
+        header.type = DEFORM_RG32F;
+        header.sentinel = -1.0f;
+        header.scale[0] = header.scale[1] = 1.0f;
+        header.gainOffset = 0;
+        header.gamma = 2.2f;
+    }
+
+    dm.release();
+
+    dm.map = map;
+    dm.mapSize = size;
+    dm.data = (char*)map + offset;
+    dm.p = header.type == DEFORM_RG32F ? (float*)dm.data : NULL;
+    dm.width = w;
+    dm.height = h;
+    dm.type = header.type;
+    dm.sentinel = header.sentinel;
+    dm.scale[0] = header.scale[0];
+    dm.scale[1] = header.scale[1];
+    dm.gain = header.gainOffset ? (uint32_t*)((char*)map + header.gainOffset) : NULL;
+    dm.gamma = header.gamma;
+
+    return 0;
+}
+
+int saveDeform(const DeformMap &dm, string fn)
+{
+    DeformHeader header;
+    memset(&header, 0, sizeof(DeformHeader));
+
+    memcpy(header.magic, DEFORM_MAGIC, 4);
+    header.version = DEFORM_VERSION;
+    header.width = dm.width;
+    header.height = dm.height;
+    header.type = dm.type;
+    header.sentinel = dm.sentinel;
+    header.offset = DEFORM_ALIGN;
+    header.size = dm.size();
+    header.checksum = deformChecksum(dm.data, header.size);
+    header.scale[0] = dm.scale[0];
+    header.scale[1] = dm.scale[1];
+    header.gamma = dm.gamma;
+
+    size_t gainSize = sizeof(uint32_t)*dm.width*dm.height;
+    size_t end = header.offset + header.size;
+    if(dm.gain)
+    {
+        header.gainOffset = (end + DEFORM_ALIGN - 1) / DEFORM_ALIGN * DEFORM_ALIGN;
+        header.gainChecksum = deformChecksum(dm.gain, gainSize);
+    }
+
+    ofstream file (fn.c_str(), ios::out|ios::binary|ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout<<"Fail to open "<<fn<<std::endl;
+        return -1;
+    }
+
+    vector<char> pad(DEFORM_ALIGN - sizeof(DeformHeader), 0);
+
+    file.write((const char*)&header, sizeof(DeformHeader));
+    file.write(&pad[0], pad.size());
+    file.write((const char*)dm.data, header.size);
+    if(dm.gain)
+    {
+        pad.assign(header.gainOffset - end, 0);
+        file.write(&pad[0], pad.size());
+        file.write((const char*)dm.gain, gainSize);
+    }
+    file.close();
+
+    if(!file)
+    {
+        std::cout<<"Fail to write "<<fn<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int convertDeform(DeformMap &dst, const DeformMap &src, uint32_t type, size_t srcWidth, size_t srcHeight)
+{
+    if(src.data == NULL || type < DEFORM_RG32F || type > DEFORM_RG16)
+    {
+        std::cout<<"Invalid deformation conversion"<<std::endl;
+        return -1;
+    }
+
+    // dst may be src
+    size_t w = src.width, h = src.height;
+    size_t n = w*h;
+    char *data = NULL;
+    uint32_t *gain = NULL;
+    float gamma = src.gamma;
+
+    try
+    {
+        data = new char [deformPixelSize(type)*n];
+        if(src.gain)
+            gain = new uint32_t [n];
+    }
+    catch(...)
+    {
+        delete []data;
+        std::cout<<"Fail to allocate memory for deformation"<<std::endl;
+        return -1;
+    }
+
+    if(src.gain)
+        memcpy(gain, src.gain, n*sizeof(uint32_t));
+
+    float scale[2] = {1.0f, 1.0f};
+    if(type == DEFORM_RG16)
+    {
+        // 0xffff is the sentinel, so the largest code is 65534
+        scale[0] = (float)srcWidth/(DEFORM_RG16_SENTINEL-1);
+        scale[1] = (float)srcHeight/(DEFORM_RG16_SENTINEL-1);
+    }
+
+    for(size_t i=0; i<n; i++)
+    {
+        float st[2];
+        src.st(i%w, i/w, st[0], st[1]);
+        bool valid = st[0]!=src.sentinel && st[1]!=src.sentinel;
+
+        for(int c=0; c<2; c++)
+        {
+            if(type == DEFORM_RG32F)
+            {
+                ((float*)data)[2*i+c] = valid ? st[c] : -1.0f;
+            }
+            else if(type == DEFORM_RG16F)
+            {
+                ((uint16_t*)data)[2*i+c] = floatToHalf(valid ? st[c] : -1.0f);
+            }
+            else
+            {
+                float code = floor(st[c]/scale[c] + 0.5f);
+                code = code < 0 ? 0 : (code > DEFORM_RG16_SENTINEL-1 ? DEFORM_RG16_SENTINEL-1 : code);
+                ((uint16_t*)data)[2*i+c] = valid ? (uint16_t)code : DEFORM_RG16_SENTINEL;
+            }
+        }
+    }
+
+    dst.release();
+
+    dst.data = data;
+    dst.p = type == DEFORM_RG32F ? (float*)data : NULL;
+    dst.width = w;
+    dst.height = h;
+    dst.sentinel = -1.0f;
+    dst.type = type;
+    dst.scale[0] = scale[0];
+    dst.scale[1] = scale[1];
+    dst.gain = gain;
+    dst.gamma = gamma;
+
+    return 0;
+}
+
+int setDeformGain(DeformMap &dm, const uint32_t *gain, float gamma)
+{
+    if(dm.data == NULL || !(gamma > 0.0f))
+    {
+        std::cout<<"Invalid photometric correction"<<std::endl;
+        return -1;
+    }
+
+    uint32_t *copy = NULL;
+    if(gain)
+    {
+        size_t n = dm.width*dm.height;
+        try
+        {
+            copy = new uint32_t [n];
+        }
+        catch(...)
+        {
+            std::cout<<"Fail to allocate memory for photometric correction"<<std::endl;
+            return -1;
+        }
+        memcpy(copy, gain, n*sizeof(uint32_t));
+    }
+
+    if(dm.gain && !inMap(dm, dm.gain))
+        delete []dm.gain;
+
+    dm.gain = copy;
+    dm.gamma = gamma;
+
+    return 0;
+}
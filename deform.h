@@ -0,0 +1,184 @@
+// deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// one (s,t) pair per projector pixel (RG32F), giving the panorama pixel
+// position that is shown at that projector pixel; rows are in file order,
+// i.e. the order glTexImage2D uploads them.
+// (-1,-1) marks projector pixels that have no source.
+//
+// maps can also be kept in 4 bytes per pixel, halving what every warp
+// reads: RG16F (half floats, -1 is exact) or RG16, unsigned fixed point
+// with s = code*scaleS, t = code*scaleT and code 0xffff for no source.
+// sentinel is always the decoded value.
+//
+// a map may carry a photometric correction (photometric.h), per projector
+// pixel a gain and a black level packed as two unorm16 in a uint32_t, the
+// gain in the low half, and the projector's gamma. in a file the gains
+// follow the pixels at the next page aligned offset.
+//
+// files are either raw (just the pixels, size given by the caller) or
+// start with a DeformHeader and keep the pixels at a page aligned offset.
+// both are memory mapped, so loading costs page faults instead of a read
+// and a copy, and p can be handed to glTexImage2D or a Warp as it is.
+//
+
+#ifndef DEFORM_H
+#define DEFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#define DEFORM_MAGIC "DFRM"
+#define DEFORM_VERSION 3 // 2 adds the fixed point scale, 3 the gains
+#define DEFORM_ALIGN 4096
+
+// pixel encoding
+enum DeformType
+{
+    DEFORM_RG32F = 1,
+    DEFORM_RG16F = 2,
+    DEFORM_RG16 = 3,
+};
+
+#define DEFORM_RG16_SENTINEL 0xffff
+
+struct DeformHeader
+{
+    char magic[4];      // DEFORM_MAGIC
+    uint32_t version;   // DEFORM_VERSION
+    uint32_t width;     // projector pixels
+    uint32_t height;
+    uint32_t type;      // DeformType
+    float sentinel;     // no source
+    uint64_t offset;    // of the pixels, multiple of DEFORM_ALIGN
+    uint64_t size;      // of the pixels in bytes
+    uint32_t checksum;  // crc32 of the pixels
+    uint32_t reserved;
+    float scale[2];     // of RG16 codes, version 2
+    uint64_t gainOffset;   // of the gains, 0 if there are none, version 3
+    uint32_t gainChecksum; // crc32 of the gains
+    float gamma;           // of the projector
+};
+
+static inline size_t deformPixelSize(uint32_t type)
+{
+    return type == DEFORM_RG32F ? 2*sizeof(float) : 2*sizeof(uint16_t);
+}
+
+// half float bits to float, exact for zero, denormals and normals: the
+// exponent is rebiased by a multiply with 2^112
+static inline float halfToFloat(uint16_t h)
+{
+    uint32_t bits = (uint32_t)(h & 0x7fff) << 13;
+    float f;
+    memcpy(&f, &bits, 4);
+    f *= 5.192296858534828e33f; // 2^112
+    memcpy(&bits, &f, 4);
+    bits |= (uint32_t)(h & 0x8000) << 16;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+// round to nearest even
+uint16_t floatToHalf(float f);
+
+// gain and black level in [0,1] as stored
+static inline uint32_t packGain(float gain, float black)
+{
+    gain = gain < 0.0f ? 0.0f : (gain > 1.0f ? 1.0f : gain);
+    black = black < 0.0f ? 0.0f : (black > 1.0f ? 1.0f : black);
+    return (uint32_t)(gain*65535.0f + 0.5f) | ((uint32_t)(black*65535.0f + 0.5f) << 16);
+}
+
+class DeformMap
+{
+public:
+    DeformMap();
+    ~DeformMap();
+
+    // it owns data, gain and the mapping, copies would free them twice
+    DeformMap(const DeformMap&) = delete;
+    DeformMap& operator=(const DeformMap&) = delete;
+
+    void release();
+
+    // panorama position of projector pixel (x,y), decoded
+    void st(size_t x, size_t y, float &s, float &t) const
+    {
+        size_t i = 2*(y*width + x);
+        if(type == DEFORM_RG32F)
+        {
+            s = p[i];
+            t = p[i+1];
+        }
+        else
+        {
+            const uint16_t *q = (const uint16_t*)data + i;
+            if(type == DEFORM_RG16F)
+            {
+                s = halfToFloat(q[0]);
+                t = halfToFloat(q[1]);
+            }
+            else if(q[0] == DEFORM_RG16_SENTINEL || q[1] == DEFORM_RG16_SENTINEL)
+            {
+                s = t = sentinel;
+            }
+            else
+            {
+                s = q[0]*scale[0];
+                t = q[1]*scale[1];
+            }
+        }
+    }
+
+    // projector pixel (x,y) maps to a panorama pixel
+    bool valid(size_t x, size_t y) const
+    {
+        float s, t;
+        st(x, y, s, t);
+        return s!=sentinel && t!=sentinel;
+    }
+
+    size_t size() const
+    {
+        return deformPixelSize(type)*width*height;
+    }
+
+public:
+    void *data;  // pixels in their encoding
+    float *p;    // the same as RG32F, NULL otherwise
+    size_t width, height;
+    float sentinel;
+    uint32_t type;
+    float scale[2];
+    uint32_t *gain; // per pixel gain and black level, NULL if none
+    float gamma;
+
+    void *map;      // mapping backing p, or NULL if p was allocated
+    size_t mapSize;
+};
+
+// load a deformation map; w x h is the size expected for raw files and is
+// ignored when the file has a header. verify checks the crc32, which
+// touches every page
+int loadDeform(DeformMap &dm, std::string fn, size_t w, size_t h, bool verify = false);
+
+// write dm with a header
+int saveDeform(const DeformMap &dm, std::string fn);
+
+// give dm a copy of width x height packed gains, or drop them if gain is NULL
+int setDeformGain(DeformMap &dm, const uint32_t *gain, float gamma);
+
+// re-encode src as type into dst, which may be src; RG16 spans srcWidth x
+// srcHeight, the panorama, with 65534 codes. gains are kept
+int convertDeform(DeformMap &dst, const DeformMap &src, uint32_t type, size_t srcWidth, size_t srcHeight);
+
+// DeformType by name, "rg32f", "rg16f" or "rg16"; 0 if unknown
+uint32_t deformType(const char *name);
+const char* deformTypeName(uint32_t type);
+
+uint32_t deformChecksum(const void *data, size_t size);
+
+#endif // DEFORM_H
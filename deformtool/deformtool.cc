@@ -0,0 +1,248 @@
+// deformtool is to convert and inspect curve2dmap deformation maps
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// usage:
+//  deformtool info <deform> [width height]
+//  deformtool pack <raw.bin> <out> [width height]
+//  deformtool mesh <deform> [step [max error]]
+//  deformtool convert <deform> <out> <rg32f|rg16f|rg16> [panorama width height]
+//  deformtool photometric <deform> <out> <gamma> <black level> [gain.png]
+//
+
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "deform.h"
+#include "mesh.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// raw files carry no size
+size_t width = 608;
+size_t height = 684;
+
+// RG16 codes span the panorama
+size_t srcWidth = 1440;
+size_t srcHeight = 360;
+
+// print the map and check its checksum if it has a header
+static int info(string fn)
+{
+    DeformMap dm;
+    if(loadDeform(dm, fn, width, height, true))
+        return -1;
+
+    size_t nvalid = 0;
+    for(size_t y=0; y<dm.height; y++)
+        for(size_t x=0; x<dm.width; x++)
+            nvalid += dm.valid(x, y);
+
+    bool raw = (dm.data == dm.map);
+
+    printf("%s: %s, %zux%zu %s, sentinel %g, %zu valid pixels (%.1f%%)%s\n", fn.c_str(),
+           raw ? "raw" : "header", dm.width, dm.height, deformTypeName(dm.type), dm.sentinel,
+           nvalid, 100.0*nvalid/(dm.width*dm.height), raw ? "" : ", checksum ok");
+    if(dm.type == DEFORM_RG16)
+        printf("code scale %g %g px\n", dm.scale[0], dm.scale[1]);
+
+    if(dm.gain)
+    {
+        size_t n = dm.width*dm.height;
+        uint32_t lo = 0xffff, hi = 0, black = 0;
+        for(size_t i=0; i<n; i++)
+        {
+            uint32_t g = dm.gain[i] & 0xffff;
+            lo = g < lo ? g : lo;
+            hi = g > hi ? g : hi;
+            black = (dm.gain[i] >> 16) > black ? (dm.gain[i] >> 16) : black;
+        }
+        printf("photometric gains %.3f to %.3f, black level up to %.3f, gamma %g\n",
+               lo/65535.0, hi/65535.0, black/65535.0, dm.gamma);
+    }
+
+    return 0;
+}
+
+// size and error of mesh approximations, to pick the grid density
+static int mesh(string fn, size_t step, float maxError)
+{
+    DeformMap dm;
+    if(loadDeform(dm, fn, width, height))
+        return -1;
+
+    size_t steps[] = {4, 8, 16, 32};
+    size_t nsteps = sizeof(steps)/sizeof(steps[0]);
+    if(step)
+    {
+        steps[0] = step;
+        nsteps = 1;
+    }
+
+    printf("map %.2f MB\n", dm.size()/1048576.0);
+    for(size_t i=0; i<nsteps; i++)
+    {
+        WarpMesh m;
+        if(m.build(dm, steps[i], maxError))
+            return -1;
+
+        printf("step %2zu, max error %.3f: %7zu cells %8zu triangles %7.2f MB, error max %.4f rms %.4f px\n",
+               steps[i], maxError, m.cells, m.indices.size()/3, m.bytes()/1048576.0, m.maxError, m.rmsError);
+    }
+
+    return 0;
+}
+
+// re-encode a map and report the source position error against it
+static int convert(string fn, string out, uint32_t type)
+{
+    DeformMap dm, converted;
+    if(loadDeform(dm, fn, width, height))
+        return -1;
+    if(convertDeform(converted, dm, type, srcWidth, srcHeight))
+        return -1;
+
+    size_t nvalid = 0, mismatch = 0;
+    double worst = 0.0, squares = 0.0;
+    for(size_t y=0; y<dm.height; y++)
+    {
+        for(size_t x=0; x<dm.width; x++)
+        {
+            bool valid = dm.valid(x, y);
+            if(valid != converted.valid(x, y))
+                mismatch++;
+            if(!valid)
+                continue;
+
+            float s, t, cs, ct;
+            dm.st(x, y, s, t);
+            converted.st(x, y, cs, ct);
+
+            double e2 = (double)(cs - s)*(cs - s) + (double)(ct - t)*(ct - t);
+            squares += e2;
+            if(e2 > worst)
+                worst = e2;
+            nvalid++;
+        }
+    }
+
+    printf("%s -> %s: %.2f MB -> %.2f MB, error max %.4f rms %.4f px, %zu validity mismatches\n",
+           deformTypeName(dm.type), deformTypeName(type), dm.size()/1048576.0, converted.size()/1048576.0,
+           sqrt(worst), nvalid ? sqrt(squares/nvalid) : 0.0, mismatch);
+
+    if(saveDeform(converted, out))
+        return -1;
+
+    return info(out);
+}
+
+// attach gains: per pixel from a grayscale image of the projector size,
+// white is unity gain, or unity everywhere; one black level for all
+static int photometric(string fn, string out, float gamma, float black, const char *gainFile)
+{
+    DeformMap dm;
+    if(loadDeform(dm, fn, width, height))
+        return -1;
+
+    size_t n = dm.width*dm.height;
+    vector<uint32_t> gain(n, packGain(1.0f, black));
+
+    if(gainFile)
+    {
+        int w, h, c;
+        unsigned char *image = stbi_load(gainFile, &w, &h, &c, 1);
+        if(image == NULL || (size_t)w != dm.width || (size_t)h != dm.height)
+        {
+            std::cout<<"Gain map "<<gainFile<<" is not a "<<dm.width<<"x"<<dm.height<<" image"<<std::endl;
+            stbi_image_free(image);
+            return -1;
+        }
+
+        for(size_t i=0; i<n; i++)
+            gain[i] = packGain(image[i]/255.0f, black);
+        stbi_image_free(image);
+    }
+
+    if(setDeformGain(dm, &gain[0], gamma))
+        return -1;
+    if(saveDeform(dm, out))
+        return -1;
+
+    return info(out);
+}
+
+//
+// main func
+//
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        std::cout<<"usage: deformtool info <deform> [width height]"<<std::endl;
+        std::cout<<"       deformtool pack <raw.bin> <out> [width height]"<<std::endl;
+        std::cout<<"       deformtool mesh <deform> [step [max error]]"<<std::endl;
+        std::cout<<"       deformtool convert <deform> <out> <rg32f|rg16f|rg16> [panorama width height]"<<std::endl;
+        std::cout<<"       deformtool photometric <deform> <out> <gamma> <black level> [gain.png]"<<std::endl;
+        return -1;
+    }
+
+    if (strcmp(argv[1], "info") == 0)
+    {
+        if(argc > 4)
+        {
+            width = atoi(argv[3]);
+            height = atoi(argv[4]);
+        }
+        return info(argv[2]);
+    }
+    else if (strcmp(argv[1], "pack") == 0 && argc > 3)
+    {
+        if(argc > 5)
+        {
+            width = atoi(argv[4]);
+            height = atoi(argv[5]);
+        }
+
+        DeformMap dm;
+        if(loadDeform(dm, argv[2], width, height))
+            return -1;
+        if(saveDeform(dm, argv[3]))
+            return -1;
+
+        return info(argv[3]);
+    }
+
+    else if (strcmp(argv[1], "mesh") == 0)
+    {
+        return mesh(argv[2], argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atof(argv[4]) : 0.25f);
+    }
+    else if (strcmp(argv[1], "convert") == 0 && argc > 4)
+    {
+        uint32_t type = deformType(argv[4]);
+        if(type == 0)
+        {
+            std::cout<<"Unknown encoding "<<argv[4]<<std::endl;
+            return -1;
+        }
+        if(argc > 6)
+        {
+            srcWidth = atoi(argv[5]);
+            srcHeight = atoi(argv[6]);
+        }
+        return convert(argv[2], argv[3], type);
+    }
+    else if (strcmp(argv[1], "photometric") == 0 && argc > 5)
+    {
+        return photometric(argv[2], argv[3], atof(argv[4]), atof(argv[5]), argc > 6 ? argv[6] : NULL);
+    }
+
+    std::cout<<"Unknown command "<<argv[1]<<std::endl;
+    return -1;
+}
@@ -0,0 +1,215 @@
+// ordered dithering for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "dither.h"
+
+#include <math.h>
+#include <string.h>
+#include <iostream>
+
+Dither::Dither()
+{
+    type = DITHER_NONE;
+    size = stride = 0;
+}
+
+int Dither::mode(const char *name)
+{
+    if(strcmp(name, "none") == 0)
+        return DITHER_NONE;
+    if(strcmp(name, "bayer") == 0)
+        return DITHER_BAYER;
+    if(strcmp(name, "blue") == 0)
+        return DITHER_BLUE;
+    return -1;
+}
+
+const char* Dither::name(uint32_t mode)
+{
+    switch(mode)
+    {
+    case DITHER_NONE: return "none";
+    case DITHER_BAYER: return "bayer";
+    case DITHER_BLUE: return "blue";
+    }
+    return "unknown";
+}
+
+// M(2n) = 4M(n) + M(2)[y/n][x/n]: the lowest bits of (x,y) give the
+// highest digit
+static void bayer(std::vector<uint32_t> &t, size_t bits)
+{
+    static const uint32_t m2[2][2] = {{0, 2}, {3, 1}};
+    size_t n = (size_t)1 << bits;
+
+    for(size_t y=0; y<n; y++)
+    {
+        for(size_t x=0; x<n; x++)
+        {
+            uint32_t v = 0;
+            for(size_t b=0; b<bits; b++)
+                v = 4*v + m2[(y >> b) & 1][(x >> b) & 1];
+            t[y*n + x] = v;
+        }
+    }
+}
+
+// void-and-cluster (Ulichney 1993) on a torus: an initial pattern is
+// relaxed until its tightest cluster is its largest void, then ones are
+// ranked by taking them out of the tightest clusters and all other pixels
+// by filling the largest voids
+class VoidCluster
+{
+public:
+    VoidCluster(size_t n, float sigma) : n(n), ones(n*n, 0), energy(n*n, 0.0f), kernel(n*n)
+    {
+        for(size_t y=0; y<n; y++)
+        {
+            for(size_t x=0; x<n; x++)
+            {
+                float dx = (float)(x < n/2 ? x : n - x);
+                float dy = (float)(y < n/2 ? y : n - y);
+                kernel[y*n + x] = expf(-(dx*dx + dy*dy)/(2.0f*sigma*sigma));
+            }
+        }
+    }
+
+    void set(size_t p, bool one)
+    {
+        ones[p] = one;
+        float sign = one ? 1.0f : -1.0f;
+        size_t px = p % n, py = p / n;
+        for(size_t y=0; y<n; y++)
+        {
+            // columns before px wrap around
+            const float *k = &kernel[((y + n - py) % n)*n];
+            float *e = &energy[y*n];
+            for(size_t x=0; x<px; x++)
+                e[x] += sign*k[x + n - px];
+            for(size_t x=px; x<n; x++)
+                e[x] += sign*k[x - px];
+        }
+    }
+
+    // one with the highest energy, or zero with the lowest
+    size_t cluster() const { return extreme(true); }
+    size_t largestVoid() const { return extreme(false); }
+
+private:
+    size_t extreme(bool one) const
+    {
+        size_t best = 0;
+        bool found = false;
+        for(size_t p=0; p<n*n; p++)
+        {
+            if(ones[p] != one)
+                continue;
+            if(!found || (one ? energy[p] > energy[best] : energy[p] < energy[best]))
+                best = p;
+            found = true;
+        }
+        return best;
+    }
+
+public:
+    size_t n;
+    std::vector<uint8_t> ones;
+
+private:
+    std::vector<float> energy, kernel;
+};
+
+static void blueNoise(std::vector<uint32_t> &t, size_t n)
+{
+    size_t total = n*n;
+    VoidCluster vc(n, 1.5f);
+
+    // about a tenth of the pixels, spread by a fixed LCG so the mask is
+    // the same on every run
+    uint32_t seed = 12345;
+    size_t count = 0;
+    while(count < total/10)
+    {
+        seed = seed*1664525u + 1013904223u;
+        size_t p = (seed >> 8) % total;
+        if(!vc.ones[p])
+        {
+            vc.set(p, true);
+            count++;
+        }
+    }
+
+    for(;;)
+    {
+        size_t c = vc.cluster();
+        vc.set(c, false);
+        size_t v = vc.largestVoid();
+        if(v == c)
+        {
+            vc.set(c, true);
+            break;
+        }
+        vc.set(v, true);
+    }
+
+    std::vector<uint8_t> initial = vc.ones;
+    std::vector<uint32_t> rank(total);
+
+    for(size_t r=count; r-- > 0; )
+    {
+        size_t c = vc.cluster();
+        vc.set(c, false);
+        rank[c] = r;
+    }
+
+    VoidCluster fill(n, 1.5f);
+    for(size_t p=0; p<total; p++)
+        if(initial[p])
+            fill.set(p, true);
+
+    for(size_t r=count; r<total; r++)
+    {
+        size_t v = fill.largestVoid();
+        fill.set(v, true);
+        rank[v] = r;
+    }
+
+    for(size_t p=0; p<total; p++)
+        t[p] = (uint32_t)(rank[p]*256/total);
+}
+
+int Dither::init(uint32_t mode)
+{
+    std::vector<uint32_t> tile;
+
+    switch(mode)
+    {
+    case DITHER_NONE:
+        size = 0;
+        break;
+    case DITHER_BAYER:
+        size = 16;
+        tile.assign(size*size, 0);
+        bayer(tile, 4);
+        break;
+    case DITHER_BLUE:
+        size = 64;
+        tile.assign(size*size, 0);
+        blueNoise(tile, size);
+        break;
+    default:
+        std::cout<<"Unknown dither mode "<<mode<<std::endl;
+        return -1;
+    }
+
+    type = mode;
+    stride = size ? size + 16 : 0;
+    threshold.assign(size*stride, 0);
+
+    for(size_t y=0; y<size; y++)
+        for(size_t x=0; x<stride; x++)
+            threshold[y*stride + x] = tile[y*size + (x & (size - 1))];
+
+    return 0;
+}
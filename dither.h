@@ -0,0 +1,44 @@
+// ordered dithering for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// a tile of 8-bit thresholds repeated over the frame: a 16x16 Bayer matrix
+// or a 64x64 blue noise mask made by void-and-cluster. a channel v is
+// quantized to levels as floor(v*levels/255 + (T + 0.5)/256), every pixel
+// on its own, so the bit-plane packers (bitplane.h, fsPack) do it in the
+// same pass. subframe i reads the tile shifted by (13i, 7i), so that the
+// patterns of the subframes shown after one another do not line up.
+//
+
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+enum DitherMode
+{
+    DITHER_NONE = 0,
+    DITHER_BAYER = 1,
+    DITHER_BLUE = 2,
+};
+
+class Dither
+{
+public:
+    Dither();
+
+    int init(uint32_t mode);
+
+    // DitherMode by name, "none", "bayer" or "blue"; -1 if unknown
+    static int mode(const char *name);
+    static const char* name(uint32_t mode);
+
+public:
+    uint32_t type;   // DitherMode
+    size_t size;     // of the tile, a power of two
+    size_t stride;   // size + 16, vectors of up to 16 lanes load past the edge
+    std::vector<uint32_t> threshold; // size rows of stride, 0 to 255
+};
+
+#endif // DITHER_H
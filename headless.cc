@@ -0,0 +1,103 @@
+// headless OpenGL context for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "headless.h"
+
+#include <iostream>
+
+#ifdef __linux__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+int createHeadlessContext()
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
+    if(display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        std::cout<<"Failed to initialize EGL"<<std::endl;
+        return -1;
+    }
+
+    // no surfaces at all, the default would ask for window support
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint count = 0;
+    if(!eglChooseConfig(display, configAttribs, &config, 1, &count) || count < 1)
+    {
+        std::cout<<"No EGL config for desktop OpenGL"<<std::endl;
+        return -1;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    eglBindAPI(EGL_OPENGL_API);
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if(context == EGL_NO_CONTEXT)
+    {
+        std::cout<<"Failed to create an OpenGL 3.3 core context with EGL"<<std::endl;
+        return -1;
+    }
+
+    // EGL_KHR_surfaceless_context
+    if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        std::cout<<"Failed to make the headless context current"<<std::endl;
+        return -1;
+    }
+
+    std::cout<<"headless EGL "<<major<<"."<<minor<<" context"<<std::endl;
+
+    return 0;
+}
+
+void destroyHeadlessContext()
+{
+    if(display == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(context != EGL_NO_CONTEXT)
+        eglDestroyContext(display, context);
+    eglTerminate(display);
+
+    display = EGL_NO_DISPLAY;
+    context = EGL_NO_CONTEXT;
+}
+
+#else
+
+int createHeadlessContext()
+{
+    std::cout<<"Headless rendering needs EGL, which this platform does not have"<<std::endl;
+    return -1;
+}
+
+void destroyHeadlessContext()
+{
+}
+
+#endif
@@ -0,0 +1,16 @@
+// headless OpenGL context for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// a surfaceless EGL context (Mesa's surfaceless platform when available,
+// so no display server is needed) with an OpenGL 3.3 core profile. there
+// is no default framebuffer: everything renders into FBOs and nothing is
+// throttled by vsync.
+//
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+int createHeadlessContext();
+void destroyHeadlessContext();
+
+#endif // HEADLESS_H
@@ -0,0 +1,151 @@
+// mesh approximation of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "mesh.h"
+
+#include <math.h>
+#include <iostream>
+
+WarpMesh::WarpMesh()
+{
+    cells = 0;
+    maxError = rmsError = 0.0;
+    sumSquares = 0.0;
+}
+
+int WarpMesh::build(const DeformMap &dm, size_t step, float err)
+{
+    if(step == 0 || err < 0)
+    {
+        std::cout<<"Invalid mesh step "<<step<<" or error "<<err<<std::endl;
+        return -1;
+    }
+
+    vertices.clear();
+    indices.clear();
+    cells = 0;
+    maxError = 0.0;
+    sumSquares = 0.0;
+
+    for(size_t y=0; y<dm.height; y+=step)
+        for(size_t x=0; x<dm.width; x+=step)
+            cell(dm, x, y, x+step < dm.width ? x+step : dm.width, y+step < dm.height ? y+step : dm.height, err);
+
+    size_t nvalid = 0;
+    for(size_t y=0; y<dm.height; y++)
+        for(size_t x=0; x<dm.width; x++)
+            nvalid += dm.valid(x, y);
+
+    rmsError = nvalid ? sqrt(sumSquares / nvalid) : 0.0;
+
+    return 0;
+}
+
+// pixels [x0,x1) x [y0,y1)
+void WarpMesh::cell(const DeformMap &dm, size_t x0, size_t y0, size_t x1, size_t y1, float err)
+{
+    size_t nx = x1 - x0, ny = y1 - y0;
+
+    size_t nvalid = 0;
+    for(size_t y=y0; y<y1; y++)
+        for(size_t x=x0; x<x1; x++)
+            nvalid += dm.valid(x, y);
+
+    if(nvalid == 0)
+        return;
+
+    // corners of the bilinear through the corner pixel centers
+    float c[4][2]; // (x0,y0) (x1,y0) (x0,y1) (x1,y1)
+    if(nvalid == nx*ny)
+    {
+        float a[2], b[2], e[2], d[2];
+        dm.st(x0, y0, a[0], a[1]);
+        dm.st(x1-1, y0, b[0], b[1]);
+        dm.st(x0, y1-1, e[0], e[1]);
+        dm.st(x1-1, y1-1, d[0], d[1]);
+
+        float fx = nx > 1 ? 0.5f/(nx-1) : 0.0f;
+        float fy = ny > 1 ? 0.5f/(ny-1) : 0.0f;
+
+        for(int k=0; k<2; k++)
+        {
+            float l0 = a[k] - (b[k]-a[k])*fx, r0 = b[k] + (b[k]-a[k])*fx;
+            float l1 = e[k] - (d[k]-e[k])*fx, r1 = d[k] + (d[k]-e[k])*fx;
+
+            c[0][k] = l0 - (l1-l0)*fy;
+            c[1][k] = r0 - (r1-r0)*fy;
+            c[2][k] = l1 + (l1-l0)*fy;
+            c[3][k] = r1 + (r1-r0)*fy;
+        }
+    }
+
+    // interpolated as the two triangles (00,10,11) and (00,11,01) are
+    double worst = 0.0, squares = 0.0;
+    if(nvalid == nx*ny)
+    {
+        for(size_t y=y0; y<y1; y++)
+        {
+            for(size_t x=x0; x<x1; x++)
+            {
+                float u = (x - x0 + 0.5f) / nx;
+                float v = (y - y0 + 0.5f) / ny;
+                float st[2];
+                dm.st(x, y, st[0], st[1]);
+
+                double e2 = 0.0;
+                for(int k=0; k<2; k++)
+                {
+                    float s = u >= v ? c[0][k] + u*(c[1][k]-c[0][k]) + v*(c[3][k]-c[1][k])
+                                     : c[0][k] + v*(c[2][k]-c[0][k]) + u*(c[3][k]-c[2][k]);
+                    e2 += (double)(s - st[k])*(s - st[k]);
+                }
+
+                squares += e2;
+                if(e2 > worst)
+                    worst = e2;
+            }
+        }
+        worst = sqrt(worst);
+    }
+
+    // split, one pixel cells are exact
+    if((nvalid < nx*ny || worst > err) && (nx > 1 || ny > 1))
+    {
+        size_t xm = nx > 1 ? x0 + (nx+1)/2 : x1;
+        size_t ym = ny > 1 ? y0 + (ny+1)/2 : y1;
+
+        cell(dm, x0, y0, xm, ym, err);
+        if(xm < x1)
+            cell(dm, xm, y0, x1, ym, err);
+        if(ym < y1)
+            cell(dm, x0, ym, xm, y1, err);
+        if(xm < x1 && ym < y1)
+            cell(dm, xm, ym, x1, y1, err);
+        return;
+    }
+
+    if(worst > maxError)
+        maxError = worst;
+    sumSquares += squares;
+
+    uint32_t base = vertices.size() / 4;
+    const float x[2] = {(float)x0, (float)x1};
+    const float y[2] = {(float)y0, (float)y1};
+    for(int j=0; j<2; j++)
+    {
+        for(int i=0; i<2; i++)
+        {
+            vertices.push_back(x[i]);
+            vertices.push_back(y[j]);
+            vertices.push_back(c[2*j+i][0]);
+            vertices.push_back(c[2*j+i][1]);
+        }
+    }
+
+    const uint32_t tri[6] = {0, 1, 3, 0, 3, 2};
+    for(int i=0; i<6; i++)
+        indices.push_back(base + tri[i]);
+
+    cells++;
+}
@@ -0,0 +1,54 @@
+// mesh approximation of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// the map is cut into cells of step x step projector pixels, each drawn
+// as two triangles whose corners carry (s,t), so the rasterizer
+// interpolates the panorama position instead of a texel being fetched
+// per pixel. a cell is split in four until the (s,t) interpolated at
+// every pixel center is within maxError panorama pixels of the map, and
+// until it holds only valid pixels; cells without any are dropped, so
+// pixels without source are simply not drawn.
+//
+// cell corners sit on pixel corners, never on a pixel center, so which
+// cell a pixel belongs to does not depend on the rasterizer's fill rule.
+// corner values extrapolate the bilinear through the four corner pixel
+// centers of the cell; a one pixel cell is flat and exact.
+//
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "deform.h"
+
+class WarpMesh
+{
+public:
+    WarpMesh();
+
+    int build(const DeformMap &dm, size_t step, float maxError);
+
+    size_t bytes() const
+    {
+        return vertices.size()*sizeof(float) + indices.size()*sizeof(uint32_t);
+    }
+
+public:
+    // x, y in projector pixels (rows in memory order), s, t in panorama pixels
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices; // triangles
+    size_t cells;
+
+    // over all valid pixels, in panorama pixels
+    double maxError, rmsError;
+
+private:
+    void cell(const DeformMap &dm, size_t x0, size_t y0, size_t x1, size_t y1, float maxError);
+
+    double sumSquares;
+};
+
+#endif // MESH_H
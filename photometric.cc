@@ -0,0 +1,23 @@
+// photometric correction for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "photometric.h"
+
+#include <math.h>
+
+Photometric::Photometric()
+{
+    init(2.2f);
+}
+
+void Photometric::init(float g)
+{
+    gamma = g;
+
+    for(int c=0; c<256; c++)
+        decode[c] = powf(c/255.0f, gamma);
+
+    for(int i=0; i<PHOTO_LEVELS; i++)
+        encode[i] = (uint32_t)(255.0f*powf((float)i/(PHOTO_LEVELS - 1), 1.0f/gamma) + 0.5f);
+}
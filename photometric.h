@@ -0,0 +1,53 @@
+// photometric correction for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// brightness on a curved screen falls off toward the projector edges. the
+// gains of a deformation map (deform.h) even it out in the warp itself: a
+// warped channel c of a projector pixel with gain g and black level b is
+// taken to linear light, scaled, lifted and taken back
+//
+//     l = decode[c]
+//     c' = encode[round((g*(1 - b)*l + b)*(PHOTO_LEVELS - 1))]
+//
+// with decode[c] = (c/255)^gamma and encode its inverse. the CPU kernels
+// and fsWarp read the same tables, alpha is kept.
+//
+
+#ifndef PHOTOMETRIC_H
+#define PHOTOMETRIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHOTO_LEVELS 4096
+
+class Photometric
+{
+public:
+    Photometric();
+
+    void init(float gamma);
+
+    // pixel corrected by a packed gain
+    uint32_t correct(uint32_t pixel, uint32_t gain) const
+    {
+        float g = (float)(gain & 0xffff) * (1.0f/65535);
+        float b = (float)(gain >> 16) * (1.0f/65535);
+        float scale = g * (1.0f - b);
+
+        uint32_t out = pixel & 0xff000000;
+        for(int c=0; c<24; c+=8)
+        {
+            float l = decode[(pixel >> c) & 0xff] * scale + b;
+            out |= encode[(int32_t)(l * (PHOTO_LEVELS - 1) + 0.5f)] << c;
+        }
+        return out;
+    }
+
+public:
+    float gamma;
+    float decode[256];
+    uint32_t encode[PHOTO_LEVELS];
+};
+
+#endif // PHOTOMETRIC_H
@@ -0,0 +1,107 @@
+// procedural scene of curve2dmap for direct rendering
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "procedural.h"
+
+#include <iostream>
+
+Procedural::Procedural()
+{
+    ubo = 0;
+    dirty = true;
+}
+
+Procedural::~Procedural()
+{
+}
+
+int Procedural::init()
+{
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, PROCEDURAL_MAX*sizeof(Primitive), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cout<<"Fail to create the primitive buffer"<<std::endl;
+        return -1;
+    }
+
+    dirty = true;
+    return 0;
+}
+
+void Procedural::release()
+{
+    if(ubo)
+        glDeleteBuffers(1, &ubo);
+    ubo = 0;
+}
+
+int Procedural::add(const Shape &shape, PrimitiveKind kind)
+{
+    if(primitives.size() == PROCEDURAL_MAX)
+        return -1;
+
+    Primitive p;
+    p.x = shape.x;
+    p.y = shape.y;
+    p.w = shape.w;
+    p.h = shape.h;
+    p.vx = shape.vx;
+    p.vy = shape.vy;
+    p.start = shape.start;
+    p.kind = kind;
+    p.angle = shape.angle;
+    p.spin = shape.spin;
+    p.wrap = shape.wrap;
+    p.reserved = 0.0f;
+    p.r = (shape.color & 0xff) / 255.0f;
+    p.g = ((shape.color >> 8) & 0xff) / 255.0f;
+    p.b = ((shape.color >> 16) & 0xff) / 255.0f;
+    p.a = (shape.color >> 24) / 255.0f;
+    p.period = 0.0f;
+    p.speed = 0.0f;
+    p.contrast = 0.0f;
+    p.reserved2 = 0.0f;
+
+    primitives.push_back(p);
+    dirty = true;
+
+    return (int)primitives.size() - 1;
+}
+
+int Procedural::addGrating(const Shape &region, float period, float speed, float contrast)
+{
+    int i = add(region, PRIM_GRATING);
+    if(i < 0)
+        return -1;
+
+    primitives[i].period = period;
+    primitives[i].speed = speed;
+    primitives[i].contrast = contrast;
+
+    return i;
+}
+
+void Procedural::clear()
+{
+    primitives.clear();
+    dirty = true;
+}
+
+void Procedural::bind()
+{
+    if(dirty)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        if(!primitives.empty())
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, primitives.size()*sizeof(Primitive), &primitives[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        dirty = false;
+    }
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo);
+}
@@ -0,0 +1,73 @@
+// procedural scene of curve2dmap for direct rendering
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// in direct mode there is no panorama pass: fsDirect looks up (s,t) in
+// the deformation and evaluates every primitive analytically at that
+// panorama position, with edges antialiased over the pixel footprint.
+// primitives live in a uniform buffer (std140, 5 vec4 each); they are
+// tested per fragment, so this is meant for tens of bars, dots and
+// gratings, not for dense dot fields, which the Scene draws better.
+//
+// geometry and motion follow Shape (scene.h): top-left x,y and w,h in
+// panorama pixels with y down, moving from start on at vx,vy, turning at
+// spin, wrapping per wrap. a grating fills its rectangle with a sine of
+// the given period (pixels) across angle, drifting at speed pixels per
+// second, between the background and color at contrast.
+//
+
+#ifndef PROCEDURAL_H
+#define PROCEDURAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "scene.h"
+
+// has to match fsDirect
+#define PROCEDURAL_MAX 200
+
+enum PrimitiveKind
+{
+    PRIM_BAR = 0,
+    PRIM_DOT = 1,     // ellipse inscribed in the rectangle
+    PRIM_GRATING = 2,
+};
+
+struct Primitive
+{
+    float x, y, w, h;
+    float vx, vy, start, kind;
+    float angle, spin, wrap, reserved;
+    float r, g, b, a;
+    float period, speed, contrast, reserved2;
+};
+
+class Procedural
+{
+public:
+    Procedural();
+    ~Procedural();
+
+    int init();
+    void release();
+
+    // index or -1 when full
+    int add(const Shape &shape, PrimitiveKind kind = PRIM_BAR);
+    int addGrating(const Shape &region, float period, float speed, float contrast = 1.0f);
+    void clear();
+
+    // upload if anything changed and bind to binding point 0
+    void bind();
+
+public:
+    std::vector<Primitive> primitives;
+
+private:
+    GLuint ubo;
+    bool dirty;
+};
+
+#endif // PROCEDURAL_H
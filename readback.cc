@@ -0,0 +1,135 @@
+// asynchronous frame readback for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "readback.h"
+
+#include <iostream>
+
+Readback::Readback()
+{
+    width = height = 0;
+    sink = NULL;
+    user = NULL;
+    issued = collected = 0;
+}
+
+Readback::~Readback()
+{
+}
+
+int Readback::init(size_t w, size_t h, ReadbackSink s, void *u, size_t n)
+{
+    if(n < 3)
+        n = 3;
+
+    width = w;
+    height = h;
+    sink = s;
+    user = u;
+    issued = collected = 0;
+
+    pbos.resize(n);
+    fences.assign(n, (GLsync)0);
+    frames.assign(n, 0);
+    times.assign(n, 0);
+
+    glGenBuffers(n, &pbos[0]);
+    for(size_t i=0; i<n; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4*w*h, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cout<<"Fail to create pixel pack buffers"<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+void Readback::release()
+{
+    if(pbos.empty())
+        return;
+
+    for(size_t i=0; i<fences.size(); i++)
+        if(fences[i])
+            glDeleteSync(fences[i]);
+
+    glDeleteBuffers(pbos.size(), &pbos[0]);
+    pbos.clear();
+    fences.clear();
+    frames.clear();
+    times.clear();
+}
+
+void Readback::read(uint64_t frame, uint64_t time)
+{
+    const size_t n = pbos.size();
+
+    collect(false);
+    if(issued - collected == n)
+    {
+        // oldest is n frames back, its buffer and fence are only reused
+        // once it is collected, however long the GPU takes
+        GLsync fence = fences[collected % n];
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while(status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fence, 0, 1000000000);
+        collect(false);
+    }
+
+    size_t i = issued % n;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frames[i] = frame;
+    times[i] = time;
+    issued++;
+}
+
+void Readback::collect(bool wait)
+{
+    const size_t n = pbos.size();
+
+    while(collected < issued)
+    {
+        size_t i = collected % n;
+
+        GLenum status = glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+        while(wait && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fences[i], 0, 1000000000);
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+
+        glDeleteSync(fences[i]);
+        fences[i] = 0;
+
+        if(status == GL_WAIT_FAILED)
+        {
+            std::cout<<"Fail to wait for the readback of frame "<<frames[i]<<", dropped"<<std::endl;
+            collected++;
+            continue;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4*width*height, GL_MAP_READ_BIT);
+        if(pixels)
+        {
+            if(sink)
+                sink(pixels, frames[i], times[i], user);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        collected++;
+    }
+}
@@ -0,0 +1,53 @@
+// asynchronous frame readback for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// glReadPixels into a ring of pixel pack buffers, each fenced; a buffer
+// is only mapped once its fence has signaled, so reading a frame back
+// does not stall the render loop. finished frames go to a sink, oldest
+// first, on the GL thread, with the time the read was issued.
+//
+
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+typedef void (*ReadbackSink)(const void *pixels, uint64_t frame, uint64_t time, void *user);
+
+class Readback
+{
+public:
+    Readback();
+    ~Readback();
+
+    // w x h RGBA8 frames through n buffers (at least 3)
+    int init(size_t w, size_t h, ReadbackSink sink, void *user, size_t n = 3);
+    void release();
+
+    // read the bound read framebuffer; waits only if all n buffers are
+    // still in flight, i.e. the GPU is n frames behind, and then until the
+    // oldest is done. time is passed on to the sink
+    void read(uint64_t frame, uint64_t time);
+
+    // hand finished frames to the sink; wait drains all of them. a frame
+    // whose fence fails is dropped and reported
+    void collect(bool wait);
+
+public:
+    size_t width, height;
+
+private:
+    ReadbackSink sink;
+    void *user;
+    std::vector<GLuint> pbos;
+    std::vector<GLsync> fences;
+    std::vector<uint64_t> frames;
+    std::vector<uint64_t> times;
+    size_t issued, collected;
+};
+
+#endif // READBACK_H
@@ -0,0 +1,221 @@
+// frame recorder for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "recorder.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+
+Recorder::Recorder()
+{
+    fd = -1;
+    frameSize = recordSize = 0;
+    start = 0;
+    written = dropped = 0;
+    failed = false;
+    quit = false;
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+uint64_t Recorder::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// all of buf, which is RECORD_ALIGN aligned and sized
+static bool writeAll(int fd, const char *buf, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t n = write(fd, buf, size);
+#ifdef O_DIRECT
+        // some file systems take O_DIRECT at open and refuse the writes,
+        // then go on through the page cache
+        if(n < 0 && errno == EINVAL)
+        {
+            int flags = fcntl(fd, F_GETFL);
+            if(flags >= 0 && (flags & O_DIRECT) && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0)
+            {
+                std::cout<<"Direct I/O is refused, recording through the page cache"<<std::endl;
+                continue;
+            }
+        }
+#endif
+        if(n <= 0)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+int Recorder::open(std::string fn, size_t w, size_t h, size_t n)
+{
+    close();
+
+    // bypass the page cache, the recording is never read back while running
+    int flags = O_WRONLY|O_CREAT|O_TRUNC;
+#ifdef O_DIRECT
+    fd = ::open(fn.c_str(), flags|O_DIRECT, 0644);
+    if(fd < 0)
+#endif
+    fd = ::open(fn.c_str(), flags, 0644);
+
+    if(fd < 0)
+    {
+        std::cout<<"Can't open output file "<<fn<<std::endl;
+        return -1;
+    }
+#ifdef F_NOCACHE
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+
+    frameSize = 4*w*h;
+    recordSize = (sizeof(RecordFrame) + frameSize + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+    written = dropped = 0;
+    failed = false;
+    quit = false;
+
+    for(size_t i=0; i<n; i++)
+    {
+        void *p = NULL;
+        if(posix_memalign(&p, RECORD_ALIGN, recordSize) != 0)
+        {
+            std::cout<<"Fail to allocate memory for recording"<<std::endl;
+            close();
+            return -1;
+        }
+        memset(p, 0, recordSize);
+        buffers.push_back((char*)p);
+        idle.push_back(i);
+    }
+
+    // header, through the first buffer to keep O_DIRECT alignment
+    RecordHeader header;
+    memset(&header, 0, sizeof(RecordHeader));
+    memcpy(header.magic, RECORD_MAGIC, 4);
+    header.version = RECORD_VERSION;
+    header.width = w;
+    header.height = h;
+    header.format = 0;
+    header.frameSize = frameSize;
+    header.recordSize = recordSize;
+    header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    start = now();
+
+    memcpy(buffers[0], &header, sizeof(RecordHeader));
+    if(!writeAll(fd, buffers[0], RECORD_ALIGN))
+    {
+        std::cout<<"Fail to write "<<fn<<std::endl;
+        close();
+        return -1;
+    }
+    memset(buffers[0], 0, RECORD_ALIGN);
+
+    thread = std::thread(&Recorder::writer, this);
+
+    return 0;
+}
+
+void Recorder::close()
+{
+    if(thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        ready.notify_one();
+        thread.join();
+    }
+
+    if(fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+
+    for(size_t i=0; i<buffers.size(); i++)
+        free(buffers[i]);
+    buffers.clear();
+    idle.clear();
+    queue.clear();
+}
+
+bool Recorder::push(const void *frame, uint64_t id, uint64_t time)
+{
+    size_t i;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(failed)
+            return false;
+        if(idle.empty())
+        {
+            dropped++;
+            return false;
+        }
+        i = idle.back();
+        idle.pop_back();
+    }
+
+    RecordFrame *record = (RecordFrame*)buffers[i];
+    record->id = id;
+    record->time = time - start;
+    record->size = frameSize;
+    memcpy(buffers[i] + sizeof(RecordFrame), frame, frameSize);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(i);
+    }
+    ready.notify_one();
+
+    return true;
+}
+
+void Recorder::writer()
+{
+    for(;;)
+    {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(queue.empty() && !quit)
+                ready.wait(lock);
+            if(queue.empty())
+                return;
+            i = queue.front();
+            queue.pop_front();
+        }
+
+        bool ok = writeAll(fd, buffers[i], recordSize);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(i);
+        if(!ok)
+        {
+            // a partial record would move every later one off its offset,
+            // cut the file back to the last whole record and stop
+            std::cout<<"Fail to write frame "<<((RecordFrame*)buffers[i])->id<<", recording stopped"<<std::endl;
+            if(ftruncate(fd, RECORD_ALIGN + written*recordSize) != 0)
+                std::cout<<"Fail to truncate the recording to "<<written<<" frames"<<std::endl;
+            failed = true;
+            idle.insert(idle.end(), queue.begin(), queue.end());
+            queue.clear();
+            return;
+        }
+        written++;
+    }
+}
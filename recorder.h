@@ -0,0 +1,91 @@
+// frame recorder for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// frames are copied into one of a fixed set of buffers and written by a
+// dedicated thread; when every buffer is waiting for the disk the frame
+// is dropped and counted, the caller never waits for I/O. a failed write
+// stops the recording, the file keeps the frames written before it.
+//
+// the file is append only: a RecordHeader padded to RECORD_ALIGN bytes,
+// then one record per frame, a RecordFrame followed by the pixels and
+// padded to RecordHeader::recordSize, so frame k of the file starts at
+// RECORD_ALIGN + k*recordSize. records are written with O_DIRECT where
+// the file system allows it, through the page cache if it refuses them.
+//
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define RECORD_MAGIC "C2DR"
+#define RECORD_VERSION 1
+#define RECORD_ALIGN 4096
+
+struct RecordHeader
+{
+    char magic[4];          // RECORD_MAGIC
+    uint32_t version;       // RECORD_VERSION
+    uint32_t width;         // pixels
+    uint32_t height;
+    uint32_t format;        // 0: RGBA8
+    uint32_t frameSize;     // bytes of pixels per frame
+    uint64_t recordSize;    // bytes per record, multiple of RECORD_ALIGN
+    int64_t startTime;      // wall clock, ns since the unix epoch
+};
+
+struct RecordFrame
+{
+    uint64_t id;            // frame number of the render loop
+    uint64_t time;          // ns since startTime
+    uint32_t size;          // bytes of pixels that follow
+    uint32_t reserved;
+};
+
+class Recorder
+{
+public:
+    Recorder();
+    ~Recorder();
+
+    // w x h RGBA8 frames, buffers of them in flight
+    int open(std::string fn, size_t w, size_t h, size_t buffers = 16);
+
+    // writes what is queued and stops the writer
+    void close();
+
+    // copy a frame and queue it; false if it had to be dropped or the
+    // recording has stopped. time is a steady clock reading in ns, e.g.
+    // from now()
+    bool push(const void *frame, uint64_t id, uint64_t time);
+
+    static uint64_t now();
+
+public:
+    size_t written, dropped;
+    bool failed;    // a write failed, recording stopped
+
+private:
+    void writer();
+
+private:
+    int fd;
+    size_t frameSize, recordSize;
+    uint64_t start;             // now() at open
+    std::vector<char*> buffers; // RECORD_ALIGN aligned records
+    std::vector<size_t> idle;   // free buffers
+    std::deque<size_t> queue;   // buffers to write, in order
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool quit;
+};
+
+#endif // RECORDER_H
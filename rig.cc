@@ -0,0 +1,116 @@
+// projector rig for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "rig.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+Rig::Rig()
+{
+    width = height = 0;
+    maxWidth = maxHeight = 0;
+}
+
+int Rig::init(std::string deformFile, size_t w, size_t h)
+{
+    std::vector<std::string> files(1, deformFile);
+    std::vector<int> xs(1, -1), ys(1, -1);
+
+    return place(files, xs, ys, w, h);
+}
+
+int Rig::load(std::string fn, size_t w, size_t h)
+{
+    std::ifstream in(fn.c_str());
+    if(!in)
+    {
+        std::cout<<"Fail to open rig "<<fn<<std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> files;
+    std::vector<int> xs, ys;
+
+    std::string line;
+    for(size_t n=1; std::getline(in, line); n++)
+    {
+        size_t hash = line.find('#');
+        if(hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream fields(line);
+        std::string file;
+        if(!(fields >> file))
+            continue;
+
+        int x = -1, y = -1;
+        std::string rest;
+        if((fields >> x) && !(fields >> y))
+        {
+            std::cout<<fn<<":"<<n<<": a place is x and y"<<std::endl;
+            return -1;
+        }
+        if(x < -1 || y < -1 || (fields >> rest))
+        {
+            std::cout<<fn<<":"<<n<<": expected <deformation> [x y]"<<std::endl;
+            return -1;
+        }
+
+        files.push_back(file);
+        xs.push_back(x);
+        ys.push_back(y);
+    }
+
+    if(files.empty())
+    {
+        std::cout<<"No projectors in rig "<<fn<<std::endl;
+        return -1;
+    }
+
+    return place(files, xs, ys, w, h);
+}
+
+int Rig::place(const std::vector<std::string> &files, const std::vector<int> &xs, const std::vector<int> &ys,
+               size_t w, size_t h)
+{
+    // built in place, a Projector can't be moved
+    release();
+    std::vector<Projector>(files.size()).swap(projectors);
+
+    size_t next = 0;
+    for(size_t k=0; k<files.size(); k++)
+    {
+        Projector &p = projectors[k];
+        p.file = files[k];
+        if(loadDeform(p.deform, p.file, w, h))
+            return -1;
+
+        p.x = xs[k] < 0 ? next : (size_t)xs[k];
+        p.y = ys[k] < 0 ? 0 : (size_t)ys[k];
+        next = p.x + p.deform.width;
+
+        if(p.x + p.deform.width > width)
+            width = p.x + p.deform.width;
+        if(p.y + p.deform.height > height)
+            height = p.y + p.deform.height;
+        if(p.deform.width > maxWidth)
+            maxWidth = p.deform.width;
+        if(p.deform.height > maxHeight)
+            maxHeight = p.deform.height;
+    }
+
+    return 0;
+}
+
+void Rig::release()
+{
+    for(size_t k=0; k<projectors.size(); k++)
+        projectors[k].deform.release();
+    projectors.clear();
+
+    width = height = 0;
+    maxWidth = maxHeight = 0;
+}
@@ -0,0 +1,56 @@
+// projector rig for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// the projectors around the arena, each with its deformation map and its
+// place in the output. the panorama is rendered once and every projector
+// is warped from it into one framebuffer spanning their displays, the
+// projector at (x,y) with its map's size. a rig file has a line per
+// projector
+//
+//     <deformation> [x y]
+//
+// and '#' starts a comment; a projector without a place goes right of the
+// one before it, at the bottom (y = 0, GL's first row).
+//
+
+#ifndef RIG_H
+#define RIG_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "deform.h"
+
+class Rig
+{
+public:
+    Rig();
+
+    // a single projector
+    int init(std::string deformFile, size_t w, size_t h);
+
+    // w x h as for loadDeform, the size of raw maps
+    int load(std::string fn, size_t w, size_t h);
+    void release();
+
+    size_t size() const { return projectors.size(); }
+
+public:
+    struct Projector
+    {
+        std::string file;
+        size_t x, y;        // in the output
+        DeformMap deform;
+    };
+
+    std::vector<Projector> projectors; // loaded in place, never copied
+    size_t width, height;              // of the output
+    size_t maxWidth, maxHeight;        // of the largest map
+
+private:
+    int place(const std::vector<std::string> &files, const std::vector<int> &xs, const std::vector<int> &ys,
+              size_t w, size_t h);
+};
+
+#endif // RIG_H
@@ -0,0 +1,124 @@
+// source region of interest of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "roi.h"
+
+#include <math.h>
+#include <iostream>
+
+SourceROI::SourceROI()
+{
+    srcWidth = srcHeight = 0;
+    x = y = w = h = 0;
+    rowMin = rowMax = 0;
+}
+
+void SourceROI::init(size_t sw, size_t sh)
+{
+    srcWidth = sw;
+    srcHeight = sh;
+    columns.assign(sw, 0);
+    rowMin = (int)sh;
+    rowMax = -1;
+    x = y = w = h = 0;
+}
+
+int SourceROI::add(const DeformMap &dm, int margin)
+{
+    if(dm.data == NULL || srcWidth < 1 || srcHeight < 1 || margin < 0)
+    {
+        std::cout<<"Invalid input for source region"<<std::endl;
+        return -1;
+    }
+
+    const int sw = (int)srcWidth;
+
+    for(size_t j=0; j<dm.height; j++)
+    {
+        for(size_t i=0; i<dm.width; i++)
+        {
+            float s, t;
+            dm.st(i, j, s, t);
+            if(s==dm.sentinel || t==dm.sentinel)
+                continue;
+
+            // taps of the bilinear fetch, texel centers at integer + 0.5
+            int i0 = (int)floorf(s - 0.5f);
+            int j0 = (int)floorf(t - 0.5f);
+
+            for(int c=i0-margin; c<=i0+1+margin; c++)
+                columns[((c % sw) + sw) % sw] = 1;
+
+            if(j0 - margin < rowMin)
+                rowMin = j0 - margin;
+            if(j0 + 1 + margin > rowMax)
+                rowMax = j0 + 1 + margin;
+        }
+    }
+
+    update();
+
+    return 0;
+}
+
+void SourceROI::update()
+{
+    const int sw = (int)srcWidth;
+
+    if(rowMax < 0)
+    {
+        x = y = w = h = 0;
+        return;
+    }
+
+    // widest circular run of untouched columns, walked from a touched
+    // one so that no run is cut in two
+    int c0 = 0;
+    while(c0 < sw && columns[c0] == 0)
+        c0++;
+
+    int gap = 0, gapEnd = 0, run = 0;
+    for(int k=1; k<=sw; k++)
+    {
+        int c = (c0 + k) % sw;
+        if(columns[c] == 0)
+        {
+            run++;
+            continue;
+        }
+        if(run > gap)
+        {
+            gap = run;
+            gapEnd = c;
+        }
+        run = 0;
+    }
+
+    x = gap ? gapEnd : 0;
+    w = sw - gap;
+
+    // taps past the top and bottom are clamped to the edge rows
+    int last = (int)srcHeight - 1;
+    y = rowMin < 0 ? 0 : (rowMin > last ? last : rowMin);
+    h = (rowMax < 0 ? 0 : (rowMax > last ? last : rowMax)) - y + 1;
+}
+
+size_t SourceROI::pieces(Piece piece[2]) const
+{
+    if(w <= 0 || h <= 0)
+        return 0;
+
+    Piece a = { x, y, w, h, 0 };
+    if(x + w <= (int)srcWidth)
+    {
+        piece[0] = a;
+        return 1;
+    }
+
+    a.w = (int)srcWidth - x;
+    Piece b = { 0, y, w - a.w, h, a.w };
+    piece[0] = a;
+    piece[1] = b;
+    return 2;
+}
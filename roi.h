@@ -0,0 +1,52 @@
+// source region of interest of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// the part of the panorama a projector can show: every texel a bilinear
+// fetch at a valid (s,t) touches, grown by a margin. the panorama is a
+// cylinder, so the columns are a circular interval, the complement of the
+// widest run of unused columns; x + w may pass srcWidth, then the region
+// continues at column 0. rows are a plain interval.
+//
+// maps are added one after another, the region covers all of them, so a
+// rig of projectors renders the union of what they see.
+//
+
+#ifndef ROI_H
+#define ROI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "deform.h"
+
+class SourceROI
+{
+public:
+    SourceROI();
+
+    void init(size_t srcWidth, size_t srcHeight);
+    int add(const DeformMap &dm, int margin = 1);
+
+    // [x, x+w) x [y, y+h) as at most two pieces inside the panorama,
+    // the first one starts at x; dx is where a piece sits in the region
+    struct Piece
+    {
+        int x, y, w, h, dx;
+    };
+    size_t pieces(Piece piece[2]) const;
+
+    bool full() const { return w == (int)srcWidth && h == (int)srcHeight; }
+
+public:
+    size_t srcWidth, srcHeight;
+    int x, y, w, h;
+
+private:
+    void update();
+
+    std::vector<uint8_t> columns; // touched
+    int rowMin, rowMax;
+};
+
+#endif // ROI_H
@@ -0,0 +1,251 @@
+// GPU resident scene of curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "scene.h"
+
+#include <string.h>
+#include <iostream>
+
+// offsets of the arrays within a segment
+#define SCENE_POSITION(cap) 0
+#define SCENE_SIZE(cap) (8*(cap))
+#define SCENE_VELOCITY(cap) (16*(cap))
+#define SCENE_COLOR(cap) (24*(cap))
+#define SCENE_START(cap) (28*(cap))
+#define SCENE_ROTATION(cap) (32*(cap))
+#define SCENE_WRAP(cap) (40*(cap))
+#define SCENE_BYTES(cap) (44*(cap))
+
+static bool hasExtension(const char *name)
+{
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for(GLint i=0; i<n; i++)
+        if(strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    return false;
+}
+
+Scene::Scene()
+{
+    capacity = count = pending = 0;
+    persistent = false;
+    position = size = velocity = start = rotation = NULL;
+    color = wrap = NULL;
+    vao = corners = vbo = 0;
+    mapped = NULL;
+    segmentSize = 0;
+    current = writing = 0;
+    divisor = 0;
+}
+
+Scene::~Scene()
+{
+}
+
+int Scene::init(size_t cap, size_t n)
+{
+    if(n < 3)
+        n = 3;
+
+    capacity = cap;
+    count = pending = 0;
+    segmentSize = (SCENE_BYTES(cap) + 255) & ~(size_t)255;
+    fences.assign(n, (GLsync)0);
+    current = 0;
+    writing = 0;
+    divisor = 0;
+
+    // triangle strip of the unit quad
+    static const GLfloat quad[] = {
+        0.0f, 0.0f,
+        1.0f, 0.0f,
+        0.0f, 1.0f,
+        1.0f, 1.0f,
+    };
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &corners);
+    glBindBuffer(GL_ARRAY_BUFFER, corners);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    persistent = hasExtension("GL_ARB_buffer_storage");
+    if(persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, n*segmentSize, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, n*segmentSize, flags);
+        if(mapped == NULL)
+        {
+            std::cout<<"Fail to map the scene buffer"<<std::endl;
+            return -1;
+        }
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, n*segmentSize, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    for(GLuint a=1; a<=7; a++)
+        glEnableVertexAttribArray(a);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cout<<"Fail to create the scene buffer"<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+void Scene::release()
+{
+    if(vao == 0)
+        return;
+
+    for(size_t i=0; i<fences.size(); i++)
+        if(fences[i])
+            glDeleteSync(fences[i]);
+    fences.clear();
+
+    if(persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &corners);
+    glDeleteVertexArrays(1, &vao);
+    vao = corners = vbo = 0;
+    mapped = NULL;
+}
+
+void Scene::begin()
+{
+    writing = (current + 1) % fences.size();
+
+    // drawn n-1 scenes ago at the earliest; the segment is only written
+    // once the GPU is done with it, however long that takes
+    if(fences[writing])
+    {
+        GLenum status = glClientWaitSync(fences[writing], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while(status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fences[writing], 0, 1000000000);
+        glDeleteSync(fences[writing]);
+        fences[writing] = 0;
+    }
+
+    unsigned char *p;
+    if(persistent)
+    {
+        p = mapped + writing*segmentSize;
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        p = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, writing*segmentSize, segmentSize,
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    position = (float*)(p + SCENE_POSITION(capacity));
+    size = (float*)(p + SCENE_SIZE(capacity));
+    velocity = (float*)(p + SCENE_VELOCITY(capacity));
+    color = (uint32_t*)(p + SCENE_COLOR(capacity));
+    start = (float*)(p + SCENE_START(capacity));
+    rotation = (float*)(p + SCENE_ROTATION(capacity));
+    wrap = (uint32_t*)(p + SCENE_WRAP(capacity));
+    pending = 0;
+}
+
+int Scene::add(const Shape &shape)
+{
+    if(pending == capacity)
+        return -1;
+
+    size_t i = pending++;
+    position[2*i] = shape.x;
+    position[2*i+1] = shape.y;
+    size[2*i] = shape.w;
+    size[2*i+1] = shape.h;
+    velocity[2*i] = shape.vx;
+    velocity[2*i+1] = shape.vy;
+    color[i] = shape.color;
+    start[i] = shape.start;
+    rotation[2*i] = shape.angle;
+    rotation[2*i+1] = shape.spin;
+    wrap[i] = shape.wrap;
+
+    return (int)i;
+}
+
+void Scene::end()
+{
+    if(!persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    current = writing;
+    count = pending;
+    bindSegment(current);
+
+    position = size = velocity = start = rotation = NULL;
+    color = wrap = NULL;
+}
+
+void Scene::bindSegment(size_t i)
+{
+    size_t base = i*segmentSize;
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(base + SCENE_POSITION(capacity)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(base + SCENE_SIZE(capacity)));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(base + SCENE_VELOCITY(capacity)));
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (GLvoid*)(base + SCENE_COLOR(capacity)));
+    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(base + SCENE_START(capacity)));
+    glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(base + SCENE_ROTATION(capacity)));
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, 0, (GLvoid*)(base + SCENE_WRAP(capacity)));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Scene::draw(size_t layers)
+{
+    if(count == 0)
+        return;
+
+    glBindVertexArray(vao);
+
+    // two copies per layer
+    if(divisor != 2*layers)
+    {
+        for(GLuint a=1; a<=7; a++)
+            glVertexAttribDivisor(a, 2*layers);
+        divisor = 2*layers;
+    }
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, 2*count*layers);
+    glBindVertexArray(0);
+
+    // the segment is busy until this draw is done
+    if(fences[current])
+        glDeleteSync(fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
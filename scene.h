@@ -0,0 +1,101 @@
+// GPU resident scene of curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// shape instances as a structure of arrays in one vertex buffer, drawn
+// as instanced unit quads in a single call. shapes carry their motion
+// (start time, velocity, spin, wrap rules) and the vertex shader places
+// them from one time uniform, so animation needs no uploads either. the
+// buffer holds n segments and is persistently mapped where
+// ARB_buffer_storage is available; a new scene is written into a segment
+// the GPU is not reading (fenced per segment), so the render loop never
+// waits on it, and frames where nothing changes cost no CPU time at all.
+//
+// attribute locations: 0 corner, 1 position, 2 size, 3 velocity, 4 color,
+// 5 start, 6 rotation, 7 wrap
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+// wrap rules, the panorama is a cylinder so x wraps by default
+enum SceneWrap
+{
+    SCENE_WRAP_X = 1, // at the seam, dimx
+    SCENE_WRAP_Y = 2, // top to bottom, dimy
+};
+
+// one shape: a w x h rectangle with its top-left at x,y at time start,
+// not drawn before. it moves at vx,vy pixels per second and turns about
+// its center from angle at spin radians per second
+struct Shape
+{
+    Shape()
+    {
+        x = y = w = h = 0.0f;
+        color = 0xffffffff;
+        vx = vy = 0.0f;
+        start = 0.0f;
+        angle = spin = 0.0f;
+        wrap = SCENE_WRAP_X;
+    }
+
+    float x, y, w, h;
+    uint32_t color; // RGBA8, R low
+    float vx, vy;
+    float start;
+    float angle, spin;
+    uint32_t wrap;
+};
+
+class Scene
+{
+public:
+    Scene();
+    ~Scene();
+
+    // room for capacity instances in each of n segments (at least 3)
+    int init(size_t capacity, size_t n = 3);
+    void release();
+
+    // write a new scene: begin(), add() every instance, end(). begin
+    // waits only if the GPU still reads the next segment
+    void begin();
+    // returns the index or -1 when full
+    int add(const Shape &shape);
+    void end();
+
+    // every instance twice per layer, the second copy one turn over, to
+    // the right of a shape centered in the left half and to the left of
+    // one in the right half, for shapes across the seam: instance
+    // (2*i + copy)*layers + l is shape i in layer l
+    void draw(size_t layers);
+
+public:
+    size_t capacity;
+    size_t count;     // instances drawn
+    bool persistent;  // mapped once, or mapped per begin()
+
+    // the segment being written, valid between begin() and end()
+    float *position, *size, *velocity, *start, *rotation;
+    uint32_t *color, *wrap;
+    size_t pending;
+
+private:
+    void bindSegment(size_t i);
+
+private:
+    GLuint vao, corners, vbo;
+    unsigned char *mapped;
+    size_t segmentSize;
+    std::vector<GLsync> fences;
+    size_t current, writing;
+    size_t divisor;
+};
+
+#endif // SCENE_H
@@ -0,0 +1,155 @@
+// validity index of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "validity.h"
+
+#include <iostream>
+
+ValidityMask::ValidityMask()
+{
+    width = height = 0;
+    tile = 0;
+    count = 0;
+}
+
+int ValidityMask::build(const DeformMap &dm, size_t t)
+{
+    if(dm.data == NULL || t == 0)
+    {
+        std::cout<<"Invalid input for validity mask"<<std::endl;
+        return -1;
+    }
+
+    width = dm.width;
+    height = dm.height;
+    tile = t;
+    count = 0;
+
+    spans.clear();
+    rows.clear();
+    counts.clear();
+    levels.clear();
+    levelWidth.clear();
+    levelHeight.clear();
+
+    size_t tw = (width + tile - 1) / tile;
+    size_t th = (height + tile - 1) / tile;
+
+    try
+    {
+        // runs, and the valid pixels of each block
+        std::vector<uint32_t> blocks(tw*th, 0);
+
+        for(size_t y=0; y<height; y++)
+        {
+            rows.push_back(spans.size());
+            counts.push_back(0);
+
+            for(size_t x=0; x<width; x++)
+            {
+                if(!dm.valid(x, y))
+                    continue;
+
+                if(rows[y]==spans.size() || spans.back().x + spans.back().n != x)
+                {
+                    Span s = { (uint32_t)x, 0 };
+                    spans.push_back(s);
+                }
+                spans.back().n++;
+                counts[y]++;
+                blocks[(y/tile)*tw + x/tile]++;
+            }
+            count += counts[y];
+        }
+        rows.push_back(spans.size());
+
+        // level 0
+        levels.push_back(std::vector<uint8_t>(tw*th));
+        levelWidth.push_back(tw);
+        levelHeight.push_back(th);
+
+        for(size_t j=0; j<th; j++)
+        {
+            for(size_t i=0; i<tw; i++)
+            {
+                size_t nx = (i+1)*tile > width ? width - i*tile : tile;
+                size_t ny = (j+1)*tile > height ? height - j*tile : tile;
+                uint32_t n = blocks[j*tw + i];
+
+                levels[0][j*tw + i] = n == 0 ? EMPTY : (n == nx*ny ? FULL : MIXED);
+            }
+        }
+
+        // halve until one node is left
+        while(levelWidth.back() > 1 || levelHeight.back() > 1)
+        {
+            size_t l = levels.size() - 1;
+            size_t w = (levelWidth[l] + 1) / 2;
+            size_t h = (levelHeight[l] + 1) / 2;
+
+            levels.push_back(std::vector<uint8_t>(w*h));
+            levelWidth.push_back(w);
+            levelHeight.push_back(h);
+
+            for(size_t j=0; j<h; j++)
+            {
+                for(size_t i=0; i<w; i++)
+                {
+                    // a node past the frame counts as empty, but a node
+                    // whose in-frame children are all full is full
+                    bool empty = true, full = true;
+                    for(size_t c=0; c<4; c++)
+                    {
+                        size_t ci = 2*i + (c & 1), cj = 2*j + (c >> 1);
+                        if(ci >= levelWidth[l] || cj >= levelHeight[l])
+                            continue;
+
+                        uint8_t s = node(l, ci, cj);
+                        empty = empty && s == EMPTY;
+                        full = full && s == FULL;
+                    }
+                    levels[l+1][j*w + i] = empty ? EMPTY : (full ? FULL : MIXED);
+                }
+            }
+        }
+    }
+    catch(...)
+    {
+        std::cout<<"Fail to allocate memory for validity mask"<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+void ValidityMask::regions(std::vector<Rect> &rects) const
+{
+    rects.clear();
+    if(levels.empty())
+        return;
+
+    regions(levels.size() - 1, 0, 0, rects);
+}
+
+void ValidityMask::regions(size_t level, size_t i, size_t j, std::vector<Rect> &rects) const
+{
+    uint8_t s = node(level, i, j);
+    if(s == EMPTY)
+        return;
+
+    if(s == FULL || level == 0)
+    {
+        size_t size = tile << level;
+        size_t x0 = i*size, y0 = j*size;
+        size_t x1 = x0 + size > width ? width : x0 + size;
+        size_t y1 = y0 + size > height ? height : y0 + size;
+
+        Rect r = { (uint32_t)x0, (uint32_t)y0, (uint32_t)(x1 - x0), (uint32_t)(y1 - y0), s == FULL };
+        rects.push_back(r);
+        return;
+    }
+
+    for(size_t c=0; c<4; c++)
+        regions(level - 1, 2*i + (c & 1), 2*j + (c >> 1), rects);
+}
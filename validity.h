@@ -0,0 +1,67 @@
+// validity index of a deformation map for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// built once when the map is loaded, so nothing has to look at sentinel
+// pixels again: per row the runs of valid pixels, and a quadtree over
+// tile x tile blocks telling empty, full and mixed regions apart. level 0
+// are the blocks, every level above halves the grid until one node is
+// left; nodes past the frame count as empty.
+//
+
+#ifndef VALIDITY_H
+#define VALIDITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "deform.h"
+
+class ValidityMask
+{
+public:
+    ValidityMask();
+
+    int build(const DeformMap &dm, size_t tile = 8);
+
+    enum { EMPTY = 0, FULL = 1, MIXED = 2 };
+
+    // node (i,j) of a level
+    uint8_t node(size_t level, size_t i, size_t j) const
+    {
+        if(i >= levelWidth[level] || j >= levelHeight[level])
+            return EMPTY;
+        return levels[level][j*levelWidth[level] + i];
+    }
+
+    // valid pixels [x, x+n) of one row
+    struct Span
+    {
+        uint32_t x, n;
+    };
+
+    // pixels [x, x+w) x [y, y+h)
+    struct Rect
+    {
+        uint32_t x, y, w, h;
+        bool full;
+    };
+
+    // the largest full nodes and the mixed blocks, together they cover
+    // every valid pixel and no empty block
+    void regions(std::vector<Rect> &rects) const;
+
+public:
+    size_t width, height, tile;
+    size_t count;                  // valid pixels
+    std::vector<Span> spans;
+    std::vector<uint32_t> rows;    // spans of row y are [rows[y], rows[y+1])
+    std::vector<uint32_t> counts;  // valid pixels of row y
+    std::vector< std::vector<uint8_t> > levels;
+    std::vector<size_t> levelWidth, levelHeight;
+
+private:
+    void regions(size_t level, size_t i, size_t j, std::vector<Rect> &rects) const;
+};
+
+#endif // VALIDITY_H
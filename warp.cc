@@ -0,0 +1,268 @@
+// CPU warp engines for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp.h"
+
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+void padPanorama(const uint32_t *src, size_t w, size_t h, uint32_t *dst)
+{
+    for(size_t y=0; y<h; y++)
+    {
+        const uint32_t *in = src + y*w;
+        uint32_t *out = dst + y*(w + 2);
+
+        out[0] = in[w - 1];
+        memcpy(out + 1, in, w*sizeof(uint32_t));
+        out[w + 1] = in[0];
+    }
+}
+
+//
+// Warp
+//
+Warp::Warp()
+{
+    deform = NULL;
+    width = height = 0;
+    srcWidth = srcHeight = 0;
+    srcStride = 0;
+    wrap = false;
+    fill = 0xff000000; // opaque black
+}
+
+Warp::~Warp()
+{
+}
+
+int Warp::init(const DeformMap &dm, size_t w, size_t h)
+{
+    if(dm.data == NULL || w < 1 || h < 1)
+    {
+        std::cout<<"Invalid input for warp"<<std::endl;
+        return -1;
+    }
+
+    deform = &dm;
+    width = dm.width;
+    height = dm.height;
+    srcWidth = w;
+    srcHeight = h;
+    srcStride = wrap ? w + 2 : w;
+
+    if(dm.gain)
+        photometric.init(dm.gamma);
+
+    return mask.build(dm);
+}
+
+//
+// WarpReference
+//
+static inline float channel(uint32_t p, int c)
+{
+    return (float)((p >> (8*c)) & 0xff);
+}
+
+void WarpReference::run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1)
+{
+    const float sentinel = deform->sentinel;
+    const int sw = (int)srcWidth;
+    const int xmax = sw - 1;
+    const int ymax = (int)srcHeight - 1;
+    const uint32_t *base = wrap ? src + 1 : src;
+    const uint32_t *gain = deform->gain;
+
+    for(size_t y=y0; y<y1; y++)
+    {
+        uint32_t *out = dst + y*width;
+
+        for(size_t x=0; x<width; x++)
+        {
+            float s, t;
+            deform->st(x, y, s, t);
+
+            if(s==sentinel || t==sentinel)
+            {
+                out[x] = fill;
+                continue;
+            }
+
+            // texel centers are at integer + 0.5
+            float u = s - 0.5f;
+            float v = t - 0.5f;
+            float fu = floorf(u);
+            float fv = floorf(v);
+            float a = u - fu;
+            float b = v - fv;
+
+            int i0 = (int)fu, i1 = i0 + 1;
+            int j0 = (int)fv, j1 = j0 + 1;
+
+            if(wrap)
+            {
+                i0 = ((i0 % sw) + sw) % sw;
+                i1 = ((i1 % sw) + sw) % sw;
+            }
+            else
+            {
+                i0 = i0 < 0 ? 0 : (i0 > xmax ? xmax : i0);
+                i1 = i1 < 0 ? 0 : (i1 > xmax ? xmax : i1);
+            }
+            j0 = j0 < 0 ? 0 : (j0 > ymax ? ymax : j0);
+            j1 = j1 < 0 ? 0 : (j1 > ymax ? ymax : j1);
+
+            uint32_t p00 = base[j0*srcStride + i0];
+            uint32_t p01 = base[j0*srcStride + i1];
+            uint32_t p10 = base[j1*srcStride + i0];
+            uint32_t p11 = base[j1*srcStride + i1];
+
+            uint32_t pixel = 0;
+            for(int c=0; c<4; c++)
+            {
+                float top = channel(p00,c) + a*(channel(p01,c) - channel(p00,c));
+                float bot = channel(p10,c) + a*(channel(p11,c) - channel(p10,c));
+                float val = top + b*(bot - top);
+
+                pixel |= (uint32_t)(val + 0.5f) << (8*c);
+            }
+            out[x] = gain ? photometric.correct(pixel, gain[y*width + x]) : pixel;
+        }
+    }
+}
+
+//
+// WarpSIMD
+//
+void warpSpan_scalar(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpSpanAny<VecScalar>(st, gain, out, n, k);
+}
+
+void warpLUT_scalar(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpLUTAny<VecScalar>(src, entry, weight, gain, out, n, k);
+}
+
+// fastest first
+static const struct
+{
+    const char *name;
+    WarpSpanFunc span;
+    WarpLUTFunc lut;
+} isas[] = {
+#ifdef WARP_X86
+    {"avx512", warpSpan_avx512, warpLUT_avx512},
+    {"avx2", warpSpan_avx2, warpLUT_avx2},
+    {"sse4", warpSpan_sse4, warpLUT_sse4},
+#endif
+    {"scalar", warpSpan_scalar, warpLUT_scalar},
+};
+
+bool WarpSIMD::supported(const char *isa)
+{
+#ifdef WARP_X86
+    __builtin_cpu_init();
+    if(strcmp(isa, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if(strcmp(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(strcmp(isa, "sse4") == 0)
+        return __builtin_cpu_supports("sse4.1");
+#endif
+    return strcmp(isa, "scalar") == 0;
+}
+
+const char* WarpSIMD::best()
+{
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+        if(supported(isas[i].name))
+            return isas[i].name;
+    return "scalar";
+}
+
+WarpSIMD::WarpSIMD(const char *name)
+{
+    isa = name ? name : best();
+    span = NULL;
+    lut = NULL;
+
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+    {
+        if(strcmp(isa, isas[i].name) == 0)
+        {
+            isa = isas[i].name;
+            span = isas[i].span;
+            lut = isas[i].lut;
+        }
+    }
+}
+
+int WarpSIMD::init(const DeformMap &dm, size_t w, size_t h)
+{
+    if(span == NULL || !supported(isa))
+    {
+        std::cout<<"Warp kernel "<<isa<<" is not supported on this CPU"<<std::endl;
+        return -1;
+    }
+
+    return Warp::init(dm, w, h);
+}
+
+WarpKernelArgs WarpSIMD::args(const uint32_t *src) const
+{
+    // a padded row has columns -1 and srcWidth
+    WarpKernelArgs k;
+    k.src = wrap ? src + 1 : src;
+    k.srcWidth = srcWidth;
+    k.srcHeight = srcHeight;
+    k.srcStride = srcStride;
+    k.xmin = wrap ? -1 : 0;
+    k.xmax = wrap ? (int32_t)srcWidth : (int32_t)srcWidth - 1;
+    k.sentinel = deform->sentinel;
+    k.fill = fill;
+    k.type = deform->type;
+    k.scaleS = deform->scale[0];
+    k.scaleT = deform->scale[1];
+    k.decode = photometric.decode;
+    k.encode = photometric.encode;
+    return k;
+}
+
+void WarpSIMD::runRow(const WarpKernelArgs &k, uint32_t *dst, size_t y, size_t x0, size_t x1)
+{
+    size_t pixel = deformPixelSize(deform->type);
+    const char *line = (const char*)deform->data + y*width*pixel;
+    const uint32_t *gain = deform->gain ? deform->gain + y*width : NULL;
+    uint32_t *out = dst + y*width;
+
+    size_t x = x0;
+    for(uint32_t i=mask.rows[y]; i<mask.rows[y+1]; i++)
+    {
+        size_t a = mask.spans[i].x, b = a + mask.spans[i].n;
+        if(b <= x0)
+            continue;
+        if(a >= x1)
+            break;
+
+        a = a < x0 ? x0 : a;
+        b = b > x1 ? x1 : b;
+
+        std::fill(out + x, out + a, fill);
+        span(line + a*pixel, gain ? gain + a : NULL, out + a, b - a, k);
+        x = b;
+    }
+    std::fill(out + x, out + x1, fill);
+}
+
+void WarpSIMD::run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1)
+{
+    WarpKernelArgs k = args(src);
+
+    for(size_t y=y0; y<y1; y++)
+        runRow(k, dst, y, 0, width);
+}
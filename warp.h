@@ -0,0 +1,182 @@
+// CPU warp engines for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// a warp maps the panorama (dimx x dimy) into the projector frame
+// (width x height) through a deformation map, sampling the panorama
+// bilinearly with the same conventions as GL_LINEAR, so CPU and fsWarp
+// output agree. rows are clamped to edge; columns are clamped too unless
+// wrap is set, then they go around the cylinder like GL_REPEAT on s.
+//
+// a wrapping warp reads the panorama in the padded layout of
+// padPanorama(): srcWidth + 2 columns, a one column halo on each side
+// holding the column from the other side of the seam. the taps of any s
+// in [0, srcWidth] are then in the row, the kernels have no seam case.
+//
+// when the map has gains, every engine applies the photometric correction
+// (photometric.h) to the pixels it warps, fill is left alone.
+//
+// pixels are RGBA8 packed in a uint32_t (R in the low byte), rows in
+// memory order, i.e. the layout glTexImage2D/glReadPixels use.
+//
+
+#ifndef WARP_H
+#define WARP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "deform.h"
+#include "validity.h"
+#include "photometric.h"
+#include "warp_kernel.h"
+
+// copy a srcWidth x srcHeight panorama into dst, (srcWidth + 2) x srcHeight
+void padPanorama(const uint32_t *src, size_t srcWidth, size_t srcHeight, uint32_t *dst);
+
+class Warp
+{
+public:
+    Warp();
+    virtual ~Warp();
+
+    virtual const char* name() const = 0;
+
+    // bind a deformation map and the panorama size, index its valid pixels;
+    // wrap has to be set before
+    virtual int init(const DeformMap &dm, size_t srcWidth, size_t srcHeight);
+
+    // warp output rows [y0, y1)
+    virtual void run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1) = 0;
+
+    void run(const uint32_t *src, uint32_t *dst)
+    {
+        run(src, dst, 0, height);
+    }
+
+public:
+    const DeformMap *deform;
+    size_t width, height;       // projector
+    size_t srcWidth, srcHeight; // panorama
+    size_t srcStride;           // pixels per row of src, srcWidth + 2 if wrap
+    bool wrap;                  // src is padded, sample around the seam
+    uint32_t fill;              // written where the deformation has no source
+    ValidityMask mask;
+    Photometric photometric;    // tables for the gains of deform
+};
+
+// scalar float reference, every other engine is checked against it
+class WarpReference : public Warp
+{
+public:
+    const char* name() const { return "reference"; }
+    void run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1);
+    using Warp::run;
+};
+
+// SIMD engine, runs the build of warp_kernel.h for one instruction set:
+// "scalar", "sse4", "avx2", "avx512", or NULL for the best one this CPU has.
+// only the valid spans of a row are warped, the gaps are filled
+class WarpSIMD : public Warp
+{
+public:
+    WarpSIMD(const char *isa = NULL);
+
+    const char* name() const { return isa; }
+    int init(const DeformMap &dm, size_t srcWidth, size_t srcHeight);
+    void run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1);
+    using Warp::run;
+
+    static bool supported(const char *isa);
+    static const char* best();
+
+protected:
+    WarpKernelArgs args(const uint32_t *src) const;
+
+    // pixels [x0, x1) of row y
+    void runRow(const WarpKernelArgs &k, uint32_t *dst, size_t y, size_t x0, size_t x1);
+
+public:
+    const char *isa;
+    WarpSpanFunc span;
+    WarpLUTFunc lut;
+};
+
+// lookup table engine: init() compiles the deformation map once into, per
+// valid projector pixel, where its top-left tap is and the quantized
+// bilinear weights; sentinel pixels are dropped from the stream and only
+// described by the runs. bits is 7 or 16. lut7 packs a pixel into 32
+// bits: an 18-bit tap offset from the base of its run (a run is split
+// where the taps leave that range) and weights in 1/127, 4 bytes per valid
+// pixel, under half the float map. lut16 keeps a 32-bit tap index and
+// weights in 1/32768, 8 bytes per valid pixel. the kernel gathers the taps
+// like the span kernel of the same instruction set.
+class WarpLUT : public WarpSIMD
+{
+public:
+    WarpLUT(int bits = 7, const char *isa = NULL);
+
+    const char* name() const { return bits == 7 ? "lut7" : "lut16"; }
+    int init(const DeformMap &dm, size_t srcWidth, size_t srcHeight);
+    void run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1);
+    using Warp::run;
+
+    size_t size() const;
+
+public:
+    // valid pixels [x, x+n) of one row, entries [entry, entry+n), their
+    // taps relative to src index base
+    struct Run
+    {
+        uint32_t x, n, entry, base;
+    };
+
+    int bits;
+    std::vector<uint32_t> entry;    // lut7 offset<<14 | b<<7 | a, lut16 tap index
+    std::vector<uint32_t> weight16; // lut16 a | b<<16
+    std::vector<Run> runs;
+    std::vector<uint32_t> rowRuns;  // runs of row y are [rowRuns[y], rowRuns[y+1])
+};
+
+// runs a Warp on persistent worker threads pinned to cores. the frame is
+// split into bands of rows holding about the same number of valid
+// deformation pixels; the calling thread does the first band itself
+class WarpPool
+{
+public:
+    WarpPool();
+    ~WarpPool();
+
+    // threads 0 uses every core
+    int start(Warp *warp, size_t threads = 0);
+    void stop();
+
+    // warp one frame, returns when all bands are done; does nothing
+    // without a successful start()
+    void run(const uint32_t *src, uint32_t *dst);
+
+    size_t size() const { return bands.empty() ? 0 : bands.size() - 1; }
+
+private:
+    void worker(size_t band);
+
+public:
+    Warp *warp;
+    std::vector<size_t> bands; // band i is rows [bands[i], bands[i+1])
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const uint32_t *src;
+    uint32_t *dst;
+    uint64_t frame;   // bumped per run
+    size_t pending;   // workers still busy with frame
+    bool quit;
+};
+
+#endif // WARP_H
@@ -0,0 +1,89 @@
+// AVX2 build of the warp and bit-plane kernels, compiled with -mavx2 -mfma
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp_kernel.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct VecAVX2
+{
+    enum { N = 8 };
+    typedef __m256 vf;
+    typedef __m256i vi;
+    typedef __m256 vm;
+
+    static vf set1(float a) { return _mm256_set1_ps(a); }
+    static vi set1i(int32_t a) { return _mm256_set1_epi32(a); }
+
+    static void loadST(const float *st, vf &s, vf &t)
+    {
+        __m256 a = _mm256_loadu_ps(st);     // s0 t0 s1 t1 | s2 t2 s3 t3
+        __m256 b = _mm256_loadu_ps(st + 8); // s4 t4 s5 t5 | s6 t6 s7 t7
+
+        // s0 s1 s4 s5 | s2 s3 s6 s7, then restore the lane order
+        s = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+        t = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+        s = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(s), _MM_SHUFFLE(3,1,2,0)));
+        t = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(t), _MM_SHUFFLE(3,1,2,0)));
+    }
+    static vi load(const uint32_t *p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(uint32_t *p, vi a) { _mm256_storeu_si256((__m256i*)p, a); }
+
+    static vf add(vf a, vf b) { return _mm256_add_ps(a, b); }
+    static vf sub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+    static vf mul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+    static vf fmadd(vf a, vf b, vf c) { return _mm256_fmadd_ps(a, b, c); }
+    static vf floor(vf a) { return _mm256_floor_ps(a); }
+
+    static vi cvtt(vf a) { return _mm256_cvttps_epi32(a); }
+    static vf cvt(vi a) { return _mm256_cvtepi32_ps(a); }
+    static vf castf(vi a) { return _mm256_castsi256_ps(a); }
+    static vi casti(vf a) { return _mm256_castps_si256(a); }
+
+    static vi addi(vi a, vi b) { return _mm256_add_epi32(a, b); }
+    static vi mullo(vi a, vi b) { return _mm256_mullo_epi32(a, b); }
+    static vi clamp(vi a, vi lo, vi hi) { return _mm256_min_epi32(_mm256_max_epi32(a, lo), hi); }
+    static vi andi(vi a, vi b) { return _mm256_and_si256(a, b); }
+    static vi ori(vi a, vi b) { return _mm256_or_si256(a, b); }
+    template<int n> static vi srli(vi a) { return _mm256_srli_epi32(a, n); }
+    template<int n> static vi slli(vi a) { return _mm256_slli_epi32(a, n); }
+    static vi sll(vi a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+
+    static vi gather(const uint32_t *base, vi idx)
+    {
+        return _mm256_i32gather_epi32((const int*)base, idx, 4);
+    }
+
+    static vm invalid(vf s, vf t, vf sentinel)
+    {
+        return _mm256_or_ps(_mm256_cmp_ps(s, sentinel, _CMP_EQ_OQ), _mm256_cmp_ps(t, sentinel, _CMP_EQ_OQ));
+    }
+    static vi select(vm m, vi a, vi b)
+    {
+        return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), m));
+    }
+};
+
+} // namespace
+
+void warpSpan_avx2(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpSpanAny<VecAVX2>(st, gain, out, n, k);
+}
+
+void warpLUT_avx2(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpLUTAny<VecAVX2>(src, entry, weight, gain, out, n, k);
+}
+
+void packSpan_avx2(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither)
+{
+    packSpanAny<VecAVX2>(sub, planes, offset, out, n, dither);
+}
+
+#endif
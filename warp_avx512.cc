@@ -0,0 +1,89 @@
+// AVX-512 build of the warp and bit-plane kernels, compiled with -mavx512f
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp_kernel.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace {
+
+// gcc's unmasked intrinsics pass an undefined source vector, which -Wall
+// reports as used uninitialized; the all-lanes maskz forms pass zero and
+// compile to the same instructions
+struct VecAVX512
+{
+    enum { N = 16 };
+    enum { ALL = 0xffff };
+    typedef __m512 vf;
+    typedef __m512i vi;
+    typedef __mmask16 vm;
+
+    static vf set1(float a) { return _mm512_set1_ps(a); }
+    static vi set1i(int32_t a) { return _mm512_set1_epi32(a); }
+
+    static void loadST(const float *st, vf &s, vf &t)
+    {
+        const __m512i even = _mm512_setr_epi32(0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30);
+        const __m512i odd = _mm512_setr_epi32(1,3,5,7,9,11,13,15,17,19,21,23,25,27,29,31);
+
+        __m512 a = _mm512_loadu_ps(st);
+        __m512 b = _mm512_loadu_ps(st + 16);
+        s = _mm512_permutex2var_ps(a, even, b);
+        t = _mm512_permutex2var_ps(a, odd, b);
+    }
+    static vi load(const uint32_t *p) { return _mm512_loadu_si512((const void*)p); }
+    static void store(uint32_t *p, vi a) { _mm512_storeu_si512((void*)p, a); }
+
+    static vf add(vf a, vf b) { return _mm512_add_ps(a, b); }
+    static vf sub(vf a, vf b) { return _mm512_sub_ps(a, b); }
+    static vf mul(vf a, vf b) { return _mm512_mul_ps(a, b); }
+    static vf fmadd(vf a, vf b, vf c) { return _mm512_fmadd_ps(a, b, c); }
+    static vf floor(vf a) { return _mm512_maskz_roundscale_ps(ALL, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+
+    static vi cvtt(vf a) { return _mm512_maskz_cvttps_epi32(ALL, a); }
+    static vf cvt(vi a) { return _mm512_maskz_cvtepi32_ps(ALL, a); }
+    static vf castf(vi a) { return _mm512_castsi512_ps(a); }
+    static vi casti(vf a) { return _mm512_castps_si512(a); }
+
+    static vi addi(vi a, vi b) { return _mm512_add_epi32(a, b); }
+    static vi mullo(vi a, vi b) { return _mm512_mullo_epi32(a, b); }
+    static vi clamp(vi a, vi lo, vi hi) { return _mm512_maskz_min_epi32(ALL, _mm512_maskz_max_epi32(ALL, a, lo), hi); }
+    static vi andi(vi a, vi b) { return _mm512_and_si512(a, b); }
+    static vi ori(vi a, vi b) { return _mm512_or_si512(a, b); }
+    template<int n> static vi srli(vi a) { return _mm512_maskz_srli_epi32(ALL, a, n); }
+    template<int n> static vi slli(vi a) { return _mm512_maskz_slli_epi32(ALL, a, n); }
+    static vi sll(vi a, int n) { return _mm512_maskz_sll_epi32(ALL, a, _mm_cvtsi32_si128(n)); }
+
+    static vi gather(const uint32_t *base, vi idx)
+    {
+        return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), ALL, idx, (const int*)base, 4);
+    }
+
+    static vm invalid(vf s, vf t, vf sentinel)
+    {
+        return _mm512_cmp_ps_mask(s, sentinel, _CMP_EQ_OQ) | _mm512_cmp_ps_mask(t, sentinel, _CMP_EQ_OQ);
+    }
+    static vi select(vm m, vi a, vi b) { return _mm512_mask_blend_epi32(m, b, a); }
+};
+
+} // namespace
+
+void warpSpan_avx512(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpSpanAny<VecAVX512>(st, gain, out, n, k);
+}
+
+void warpLUT_avx512(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpLUTAny<VecAVX512>(src, entry, weight, gain, out, n, k);
+}
+
+void packSpan_avx512(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither)
+{
+    packSpanAny<VecAVX512>(sub, planes, offset, out, n, dither);
+}
+
+#endif
@@ -0,0 +1,491 @@
+// SIMD warp and bit-plane kernels for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// the kernels are written once against a small vector interface V and
+// built per instruction set (warp.cc, warp_sse4.cc, warp_avx2.cc,
+// warp_avx512.cc), each translation unit with its own compiler flags.
+// the warp does V::N output pixels per step: deinterleave (s,t), derive
+// the four tap indices, gather the taps and blend with fused weights.
+// with gains (photometric.h) the blended pixel goes through the tables
+// before it is stored, in the same loop.
+// it is instantiated per deformation encoding, so RG16F and RG16 maps are
+// decoded in registers and only half the bytes are streamed. the lookup
+// table span (WarpLUT) reads precomputed taps and weights. columns are
+// clamped to [xmin, xmax], which on a padded panorama (Warp::wrap) lets
+// the taps across the seam land on the halo, so wrapping costs nothing.
+//
+
+#ifndef WARP_KERNEL_H
+#define WARP_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+#include "deform.h"
+#include "photometric.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WARP_X86
+#endif
+
+// everything a kernel needs besides the span itself
+struct WarpKernelArgs
+{
+    const uint32_t *src;    // column 0 of row 0
+    size_t srcWidth, srcHeight;
+    size_t srcStride;       // pixels from one row to the next
+    int32_t xmin, xmax;     // columns a tap may read, see Warp::wrap
+    float sentinel;
+    uint32_t fill;
+    uint32_t type;          // DeformType of the span
+    float scaleS, scaleT;   // of RG16 codes
+    const float *decode;    // photometric tables, used with gains
+    const uint32_t *encode;
+};
+
+// warp n pixels whose (s,t), encoded as k.type, start at st; gain is NULL
+// or the packed gains of the n pixels
+typedef void (*WarpSpanFunc)(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+
+void warpSpan_scalar(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpSpan_sse4(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpSpan_avx2(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpSpan_avx512(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+
+// warp n pixels from a lookup table (WarpLUT): with weight NULL entry i
+// is offset<<14 | b<<7 | a, the top-left tap at src[offset] and weights
+// in 1/127; else entry i is the index of the top-left tap and weight i is
+// a | b<<16 in 1/32768. gain as above
+typedef void (*WarpLUTFunc)(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain,
+                            uint32_t *out, size_t n, const WarpKernelArgs &k);
+
+void warpLUT_scalar(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpLUT_sse4(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpLUT_avx2(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+void warpLUT_avx512(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k);
+
+// ordered dither of a packed span (dither.h): thresholds of a size x size
+// tile in rows of stride, the first 16 of each repeated past its end; the
+// span starts at pixel (x,y) and stays in row y
+struct PackDither
+{
+    const uint32_t *threshold;
+    size_t size, stride;
+    size_t x, y;
+};
+
+// pack pixels [offset, offset+n) of planes subframes into the bit planes of
+// out, rounded or, if dither is not NULL, dithered
+typedef void (*PackSpanFunc)(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n,
+                             const PackDither *dither);
+
+void packSpan_scalar(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither);
+void packSpan_sse4(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither);
+void packSpan_avx2(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither);
+void packSpan_avx512(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither);
+
+// everything below is instantiated in every kernel translation unit with
+// that unit's -m flags; internal linkage keeps each copy in its own unit,
+// or the linker could pick an AVX build of a scalar tail for every caller
+namespace {
+
+// one lane, also used for the tails of the vector builds
+struct VecScalar
+{
+    enum { N = 1 };
+    typedef float vf;
+    typedef int32_t vi;
+    typedef bool vm;
+
+    static vf set1(float a) { return a; }
+    static vi set1i(int32_t a) { return a; }
+
+    static void loadST(const float *st, vf &s, vf &t) { s = st[0]; t = st[1]; }
+    static vi load(const uint32_t *p) { return (vi)*p; }
+    static void store(uint32_t *p, vi a) { *p = (uint32_t)a; }
+
+    static vf add(vf a, vf b) { return a + b; }
+    static vf sub(vf a, vf b) { return a - b; }
+    static vf mul(vf a, vf b) { return a * b; }
+    static vf fmadd(vf a, vf b, vf c) { return a*b + c; }
+    static vf floor(vf a) { return floorf(a); }
+
+    static vi cvtt(vf a) { return (a > -2147483648.0f && a < 2147483648.0f) ? (vi)a : INT32_MIN; }
+    static vf cvt(vi a) { return (vf)a; }
+    static vf castf(vi a) { vf f; memcpy(&f, &a, 4); return f; }
+    static vi casti(vf a) { vi i; memcpy(&i, &a, 4); return i; }
+
+    static vi addi(vi a, vi b) { return a + b; }
+    static vi mullo(vi a, vi b) { return a * b; }
+    static vi clamp(vi a, vi lo, vi hi) { return a < lo ? lo : (a > hi ? hi : a); }
+    static vi andi(vi a, vi b) { return a & b; }
+    static vi ori(vi a, vi b) { return a | b; }
+    template<int n> static vi srli(vi a) { return (vi)((uint32_t)a >> n); }
+    template<int n> static vi slli(vi a) { return (vi)((uint32_t)a << n); }
+    static vi sll(vi a, int n) { return (vi)((uint32_t)a << n); }
+
+    static vi gather(const uint32_t *base, vi idx) { return (vi)base[idx]; }
+
+    static vm invalid(vf s, vf t, vf sentinel) { return s==sentinel || t==sentinel; }
+    static vi select(vm m, vi a, vi b) { return m ? a : b; }
+};
+
+// channel c of four taps blended with fused bilinear weights, rounded and
+// shifted back into place
+template<class V, int c>
+static inline typename V::vi blendChannel(typename V::vi p00, typename V::vi p01,
+                                          typename V::vi p10, typename V::vi p11,
+                                          typename V::vf w00, typename V::vf w01,
+                                          typename V::vf w10, typename V::vf w11)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    const vi mask = V::set1i(0xff);
+
+    vf val = V::mul(w00, V::cvt(V::andi(V::template srli<8*c>(p00), mask)));
+    val = V::fmadd(w01, V::cvt(V::andi(V::template srli<8*c>(p01), mask)), val);
+    val = V::fmadd(w10, V::cvt(V::andi(V::template srli<8*c>(p10), mask)), val);
+    val = V::fmadd(w11, V::cvt(V::andi(V::template srli<8*c>(p11), mask)), val);
+
+    return V::template slli<8*c>(V::cvtt(V::add(val, V::set1(0.5f))));
+}
+
+// halfToFloat per lane
+template<class V>
+static inline typename V::vf halfToFloat(typename V::vi h)
+{
+    typedef typename V::vi vi;
+
+    vi bits = V::template slli<13>(V::andi(h, V::set1i(0x7fff)));
+    vi f = V::casti(V::mul(V::castf(bits), V::set1(5.192296858534828e33f))); // 2^112
+    return V::castf(V::ori(f, V::template slli<16>(V::andi(h, V::set1i(0x8000)))));
+}
+
+// V::N decoded (s,t) starting at pixel x of a span encoded as type, and
+// the lanes without a source
+template<class V, int type>
+static inline void decodeST(const void *st, size_t x, const WarpKernelArgs &k,
+                            typename V::vf &s, typename V::vf &t, typename V::vm &invalid)
+{
+    typedef typename V::vi vi;
+
+    if(type == DEFORM_RG32F)
+    {
+        V::loadST((const float*)st + 2*x, s, t);
+        invalid = V::invalid(s, t, V::set1(k.sentinel));
+        return;
+    }
+
+    // one 32 bit word per pixel, s in the low half
+    vi w = V::load((const uint32_t*)st + x);
+    vi si = V::andi(w, V::set1i(0xffff));
+    vi ti = V::template srli<16>(w);
+
+    if(type == DEFORM_RG16F)
+    {
+        s = halfToFloat<V>(si);
+        t = halfToFloat<V>(ti);
+        invalid = V::invalid(s, t, V::set1(k.sentinel));
+    }
+    else
+    {
+        s = V::cvt(si);
+        t = V::cvt(ti);
+        invalid = V::invalid(s, t, V::set1((float)DEFORM_RG16_SENTINEL));
+        s = V::mul(s, V::set1(k.scaleS));
+        t = V::mul(t, V::set1(k.scaleT));
+    }
+}
+
+// the four taps of V::N pixels blended with weights a along s, b along t
+template<class V>
+static inline typename V::vi blendPixel(typename V::vi p00, typename V::vi p01,
+                                        typename V::vi p10, typename V::vi p11,
+                                        typename V::vf a, typename V::vf b)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    const vf one = V::set1(1.0f);
+
+    vf ia = V::sub(one, a);
+    vf ib = V::sub(one, b);
+    vf w00 = V::mul(ia, ib);
+    vf w01 = V::mul(a, ib);
+    vf w10 = V::mul(ia, b);
+    vf w11 = V::mul(a, b);
+
+    vi pixel = blendChannel<V,0>(p00, p01, p10, p11, w00, w01, w10, w11);
+    pixel = V::ori(pixel, blendChannel<V,1>(p00, p01, p10, p11, w00, w01, w10, w11));
+    pixel = V::ori(pixel, blendChannel<V,2>(p00, p01, p10, p11, w00, w01, w10, w11));
+    pixel = V::ori(pixel, blendChannel<V,3>(p00, p01, p10, p11, w00, w01, w10, w11));
+    return pixel;
+}
+
+// bilinear sample of the panorama at V::N positions
+template<class V>
+static inline typename V::vi warpPixel(typename V::vf s, typename V::vf t, const WarpKernelArgs &k)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    const vf half = V::set1(0.5f);
+    const vi zero = V::set1i(0);
+    const vi unit = V::set1i(1);
+    const vi xmin = V::set1i(k.xmin);
+    const vi xmax = V::set1i(k.xmax);
+    const vi ymax = V::set1i((int32_t)k.srcHeight - 1);
+    const vi stride = V::set1i((int32_t)k.srcStride);
+
+    // texel centers are at integer + 0.5
+    vf u = V::sub(s, half);
+    vf v = V::sub(t, half);
+    vf fu = V::floor(u);
+    vf fv = V::floor(v);
+    vf a = V::sub(u, fu);
+    vf b = V::sub(v, fv);
+
+    vi i0 = V::cvtt(fu);
+    vi j0 = V::cvtt(fv);
+    vi i1 = V::clamp(V::addi(i0, unit), xmin, xmax);
+    vi j1 = V::clamp(V::addi(j0, unit), zero, ymax);
+    i0 = V::clamp(i0, xmin, xmax);
+    j0 = V::clamp(j0, zero, ymax);
+
+    vi r0 = V::mullo(j0, stride);
+    vi r1 = V::mullo(j1, stride);
+
+    vi p00 = V::gather(k.src, V::addi(r0, i0));
+    vi p01 = V::gather(k.src, V::addi(r0, i1));
+    vi p10 = V::gather(k.src, V::addi(r1, i0));
+    vi p11 = V::gather(k.src, V::addi(r1, i1));
+
+    return blendPixel<V>(p00, p01, p10, p11, a, b);
+}
+
+// channel c of V::N pixels through the photometric tables
+template<class V, int c>
+static inline typename V::vi correctChannel(typename V::vi pixel, typename V::vf scale, typename V::vf black,
+                                            const WarpKernelArgs &k)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    vi v = V::andi(V::template srli<8*c>(pixel), V::set1i(0xff));
+    vf l = V::fmadd(V::castf(V::gather((const uint32_t*)k.decode, v)), scale, black);
+    vi i = V::cvtt(V::fmadd(l, V::set1((float)(PHOTO_LEVELS - 1)), V::set1(0.5f)));
+    return V::template slli<8*c>(V::gather(k.encode, i));
+}
+
+// Photometric::correct per lane
+template<class V>
+static inline typename V::vi correctPixel(typename V::vi pixel, typename V::vi gain, const WarpKernelArgs &k)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    const vf unorm = V::set1(1.0f/65535);
+
+    vf g = V::mul(V::cvt(V::andi(gain, V::set1i(0xffff))), unorm);
+    vf b = V::mul(V::cvt(V::template srli<16>(gain)), unorm);
+    vf scale = V::mul(g, V::sub(V::set1(1.0f), b));
+
+    vi out = V::andi(pixel, V::set1i((int32_t)0xff000000));
+    out = V::ori(out, correctChannel<V,0>(pixel, scale, b, k));
+    out = V::ori(out, correctChannel<V,1>(pixel, scale, b, k));
+    out = V::ori(out, correctChannel<V,2>(pixel, scale, b, k));
+    return out;
+}
+
+template<class V, int type, bool photo>
+void warpSpan(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+    typedef typename V::vm vm;
+
+    const vi fill = V::set1i((int32_t)k.fill);
+
+    size_t x = 0;
+    for(; x + V::N <= n; x += V::N)
+    {
+        // sentinel lanes still get clamped, in-range addresses
+        vf s, t;
+        vm invalid;
+        decodeST<V,type>(st, x, k, s, t, invalid);
+
+        vi pixel = warpPixel<V>(s, t, k);
+        if(photo)
+            pixel = correctPixel<V>(pixel, V::load(gain + x), k);
+
+        V::store(out + x, V::select(invalid, fill, pixel));
+    }
+
+    if(V::N > 1 && x < n)
+        warpSpan<VecScalar,type,photo>((const char*)st + x*deformPixelSize(type), photo ? gain + x : NULL,
+                                       out + x, n - x, k);
+}
+
+template<class V, bool wide, bool photo>
+void warpLUT(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain,
+             uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    typedef typename V::vf vf;
+    typedef typename V::vi vi;
+
+    const vi unit = V::set1i(1);
+    const vi stride = V::set1i((int32_t)k.srcStride);
+    const vi low = V::set1i(wide ? 0xffff : 0x7f);
+    const vf scale = V::set1(wide ? 1.0f/32768 : 1.0f/127);
+
+    size_t x = 0;
+    for(; x + V::N <= n; x += V::N)
+    {
+        vi e = V::load(entry + x);
+        vi w = wide ? V::load(weight + x) : e;
+        vi i00 = wide ? e : V::template srli<14>(e);
+        vi i10 = V::addi(i00, stride);
+
+        vf a = V::mul(V::cvt(V::andi(w, low)), scale);
+        vf b = V::mul(V::cvt(V::andi(wide ? V::template srli<16>(w) : V::template srli<7>(w), low)), scale);
+
+        vi pixel = blendPixel<V>(V::gather(src, i00), V::gather(src, V::addi(i00, unit)),
+                                 V::gather(src, i10), V::gather(src, V::addi(i10, unit)), a, b);
+        if(photo)
+            pixel = correctPixel<V>(pixel, V::load(gain + x), k);
+
+        V::store(out + x, pixel);
+    }
+
+    if(V::N > 1 && x < n)
+        warpLUT<VecScalar,wide,photo>(src, entry + x, wide ? weight + x : NULL, photo ? gain + x : NULL,
+                                      out + x, n - x, k);
+}
+
+// the span's encoding and whether it has gains are picked once per call
+template<class V, int type>
+static inline void warpSpanType(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    if(gain)
+        warpSpan<V,type,true>(st, gain, out, n, k);
+    else
+        warpSpan<V,type,false>(st, gain, out, n, k);
+}
+
+template<class V>
+void warpSpanAny(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    switch(k.type)
+    {
+    case DEFORM_RG16F:
+        warpSpanType<V,DEFORM_RG16F>(st, gain, out, n, k);
+        break;
+    case DEFORM_RG16:
+        warpSpanType<V,DEFORM_RG16>(st, gain, out, n, k);
+        break;
+    default:
+        warpSpanType<V,DEFORM_RG32F>(st, gain, out, n, k);
+    }
+}
+
+template<class V>
+void warpLUTAny(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain,
+                uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    if(weight && gain)
+        warpLUT<V,true,true>(src, entry, weight, gain, out, n, k);
+    else if(weight)
+        warpLUT<V,true,false>(src, entry, weight, gain, out, n, k);
+    else if(gain)
+        warpLUT<V,false,true>(src, entry, weight, gain, out, n, k);
+    else
+        warpLUT<V,false,false>(src, entry, weight, gain, out, n, k);
+}
+
+// bit-plane packing: subframe i is monochrome (its red channel), quantized
+// to bits = 24/planes and stored in bits [i*bits, (i+1)*bits) of the RGB
+// word, R in the low byte like everywhere else; alpha is opaque.
+// q = round(v*levels/255) is computed exactly as (t + 1 + (t>>8)) >> 8
+// with t = v*levels + 127, which holds while t < 65535, i.e. bits <= 8.
+// wider planes split levels = 255*a + b, so q = v*a + round(v*b/255)
+// with v*b < 65535 again.
+// dithered, q = floor(v*levels/255 + (T + 0.5)/256): the same expression
+// gives floor(t/255) for t = v*b, the remainder r is carried when
+// 512*r + 255*(2*T + 1) >= 130560, i.e. at bit 18 after adding 2^18 - 130560;
+// all in integers, so fsPack matches it exactly.
+template<class V, bool dithered>
+void packSpan(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n,
+              const PackDither *dither)
+{
+    typedef typename V::vi vi;
+
+    const int bits = (int)(24 / planes);
+    const bool wide = bits > 8;
+    const int levels = (1 << bits) - 1;
+    const vi mask = V::set1i(0xff);
+    const vi whole = V::set1i(levels / 255);
+    const vi part = V::set1i(wide ? levels % 255 : levels);
+    const vi half = V::set1i(dithered ? 0 : 127);
+    const vi unit = V::set1i(1);
+    const vi alpha = V::set1i((int32_t)0xff000000);
+
+    size_t x = 0;
+    for(; x + V::N <= n; x += V::N)
+    {
+        vi word = alpha;
+
+        for(size_t i=0; i<planes; i++)
+        {
+            vi v = V::andi(V::load(sub[i] + offset + x), mask);
+            vi t = V::addi(V::mullo(v, part), half);
+            vi q = V::template srli<8>(V::addi(V::addi(t, unit), V::template srli<8>(t)));
+
+            if(dithered)
+            {
+                // plane i reads the tile shifted by (13i, 7i)
+                size_t m = dither->size - 1;
+                const uint32_t *row = dither->threshold + ((dither->y + 7*i) & m)*dither->stride;
+                vi th = V::load(row + ((dither->x + x + 13*i) & m));
+
+                vi r = V::addi(t, V::mullo(q, V::set1i(-255)));
+                vi e = V::addi(V::addi(V::template slli<9>(r), V::mullo(th, V::set1i(510))), V::set1i(255 + 131584));
+                q = V::addi(q, V::template srli<18>(e));
+            }
+
+            if(wide)
+                q = V::addi(q, V::mullo(v, whole));
+
+            word = V::ori(word, V::sll(q, (int)i*bits));
+        }
+
+        V::store(out + x, word);
+    }
+
+    if(V::N > 1 && x < n)
+    {
+        PackDither tail = {NULL, 0, 0, 0, 0};
+        if(dithered)
+        {
+            tail = *dither;
+            tail.x += x;
+        }
+        packSpan<VecScalar,dithered>(sub, planes, offset + x, out + x, n - x, &tail);
+    }
+}
+
+template<class V>
+void packSpanAny(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n,
+                 const PackDither *dither)
+{
+    if(dither)
+        packSpan<V,true>(sub, planes, offset, out, n, dither);
+    else
+        packSpan<V,false>(sub, planes, offset, out, n, NULL);
+}
+
+} // namespace
+
+#endif // WARP_KERNEL_H
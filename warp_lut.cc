@@ -0,0 +1,165 @@
+// lookup table warp engine for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp.h"
+
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+WarpLUT::WarpLUT(int b, const char *name) : WarpSIMD(name)
+{
+    bits = (b == 16) ? 16 : 7;
+}
+
+size_t WarpLUT::size() const
+{
+    return entry.size()*sizeof(uint32_t) + weight16.size()*sizeof(uint32_t)
+         + runs.size()*sizeof(Run) + rowRuns.size()*sizeof(uint32_t);
+}
+
+// top-left tap and weight along one axis; taps i and i+1 always exist,
+// clamping to edge is folded into the weight (0 or 1)
+static inline void axis(float s, int n, int &i, float &a)
+{
+    float u = s - 0.5f;
+
+    if(!(u > 0.0f))
+        u = 0.0f; // also catches NaN
+    if(u > (float)(n - 1))
+        u = (float)(n - 1);
+
+    float fu = floorf(u);
+    i = (int)fu;
+    a = u - fu;
+
+    if(i >= n - 1)
+    {
+        i = n - 2;
+        a = 1.0f;
+    }
+}
+
+// along s of a padded panorama: taps i and i+1 exist for i in [-1, n-1],
+// the halo columns take the place of the clamping
+static inline void axisWrap(float s, int n, int &i, float &a)
+{
+    float u = s - 0.5f;
+
+    if(!(u > -1.0f))
+        u = -1.0f;
+    if(u > (float)n)
+        u = (float)n;
+
+    float fu = floorf(u);
+    i = (int)fu;
+    a = u - fu;
+
+    if(i >= n)
+    {
+        i = n - 1;
+        a = 1.0f;
+    }
+}
+
+int WarpLUT::init(const DeformMap &dm, size_t w, size_t h)
+{
+    if(w < 2 || h < 2)
+    {
+        std::cout<<"The panorama is too small for a warp lookup table"<<std::endl;
+        return -1;
+    }
+
+    if(WarpSIMD::init(dm, w, h))
+        return -1;
+
+    const float scale = (bits == 7) ? 127.0f : 32768.0f;
+
+    entry.clear();
+    weight16.clear();
+    runs.clear();
+    rowRuns.clear();
+
+    try
+    {
+        for(size_t y=0; y<height; y++)
+        {
+            rowRuns.push_back(runs.size());
+
+            for(size_t x=0; x<width; x++)
+            {
+                float st[2];
+                dm.st(x, y, st[0], st[1]);
+                if(st[0]==dm.sentinel || st[1]==dm.sentinel)
+                    continue;
+
+                int i, j;
+                float a, b;
+                if(wrap)
+                    axisWrap(st[0], srcWidth, i, a);
+                else
+                    axis(st[0], srcWidth, i, a);
+                axis(st[1], srcHeight, j, b);
+
+                uint32_t tap = j*srcStride + i + (wrap ? 1 : 0);
+                uint32_t qa = (uint32_t)(a*scale + 0.5f);
+                uint32_t qb = (uint32_t)(b*scale + 0.5f);
+
+                // lut7 offsets are 18 bits, a run starts centered on its first tap
+                bool split = runs.empty() || rowRuns[y]==runs.size() || runs.back().x + runs.back().n != x;
+                if(!split && bits == 7)
+                    split = tap < runs.back().base || tap - runs.back().base > 0x3ffff;
+                if(split)
+                {
+                    uint32_t base = (bits == 16 || tap < 0x20000) ? 0 : tap - 0x20000;
+                    Run r = { (uint32_t)x, 0, (uint32_t)entry.size(), base };
+                    runs.push_back(r);
+                }
+                runs.back().n++;
+
+                if(bits == 7)
+                {
+                    entry.push_back(((tap - runs.back().base) << 14) | qa | (qb << 7));
+                }
+                else
+                {
+                    entry.push_back(tap);
+                    weight16.push_back(qa | (qb << 16));
+                }
+            }
+        }
+        rowRuns.push_back(runs.size());
+    }
+    catch(...)
+    {
+        std::cout<<"Fail to allocate memory for warp lookup table"<<std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+void WarpLUT::run(const uint32_t *src, uint32_t *dst, size_t y0, size_t y1)
+{
+    WarpKernelArgs k = args(src);
+
+    for(size_t y=y0; y<y1; y++)
+    {
+        const uint32_t *gain = deform->gain ? deform->gain + y*width : NULL;
+        uint32_t *out = dst + y*width;
+        size_t x = 0;
+
+        for(uint32_t r=rowRuns[y]; r<rowRuns[y+1]; r++)
+        {
+            const Run &run = runs[r];
+
+            std::fill(out + x, out + run.x, fill);
+            lut(src + run.base, &entry[run.entry], bits == 16 ? &weight16[run.entry] : NULL,
+                gain ? gain + run.x : NULL, out + run.x, run.n, k);
+            x = run.x + run.n;
+        }
+
+        std::fill(out + x, out + width, fill);
+    }
+}
@@ -0,0 +1,155 @@
+// multithreaded warp for curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+WarpPool::WarpPool()
+{
+    warp = NULL;
+    src = NULL;
+    dst = NULL;
+    frame = 0;
+    pending = 0;
+    quit = false;
+}
+
+WarpPool::~WarpPool()
+{
+    stop();
+}
+
+// keep a thread on one of cores, so its band of the deformation and the
+// output stay in that core's cache from frame to frame
+static void pin(std::thread::native_handle_type handle, size_t core, size_t cores)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(handle, sizeof(cpu_set_t), &set);
+#endif
+}
+
+int WarpPool::start(Warp *w, size_t n)
+{
+    stop();
+    bands.clear();
+
+    if(w == NULL || w->deform == NULL)
+    {
+        std::cout<<"Warp pool needs an initialized warp"<<std::endl;
+        return -1;
+    }
+
+    warp = w;
+
+    // 0 if it cannot be told, then threads are not pinned
+    const size_t cores = std::thread::hardware_concurrency();
+
+    if(n == 0)
+        n = cores;
+    if(n < 1)
+        n = 1;
+    if(n > warp->height)
+        n = warp->height;
+
+    // cut the frame where the running count of valid pixels crosses i/n
+    const DeformMap &dm = *warp->deform;
+
+    std::vector<size_t> valid(dm.height + 1, 0);
+    for(size_t y=0; y<dm.height; y++)
+        valid[y+1] = valid[y] + warp->mask.counts[y];
+
+    bands.assign(1, 0);
+    size_t y = 0;
+    for(size_t i=1; i<n; i++)
+    {
+        size_t target = valid[dm.height]*i/n;
+        while(y < dm.height && valid[y] < target)
+            y++;
+        if(y > bands.back())
+            bands.push_back(y);
+    }
+    bands.push_back(dm.height);
+
+    quit = false;
+    frame = 0;
+    pending = 0;
+
+    for(size_t i=1; i<size(); i++)
+    {
+        threads.push_back(std::thread(&WarpPool::worker, this, i));
+        if(cores > 0)
+            pin(threads.back().native_handle(), i, cores);
+    }
+
+    return 0;
+}
+
+void WarpPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+
+    for(size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+}
+
+void WarpPool::worker(size_t band)
+{
+    uint64_t seen = 0;
+
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(!quit && frame == seen)
+                wake.wait(lock);
+            if(quit)
+                return;
+            seen = frame;
+        }
+
+        warp->run(src, dst, bands[band], bands[band+1]);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--pending == 0)
+                done.notify_one();
+        }
+    }
+}
+
+void WarpPool::run(const uint32_t *s, uint32_t *d)
+{
+    // not started, or start() failed
+    if(bands.size() < 2)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        src = s;
+        dst = d;
+        pending = threads.size();
+        frame++;
+    }
+    wake.notify_all();
+
+    warp->run(s, d, bands[0], bands[1]);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while(pending > 0)
+        done.wait(lock);
+}
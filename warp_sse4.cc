@@ -0,0 +1,87 @@
+// SSE4.1 build of the warp and bit-plane kernels, compiled with -msse4.1
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+
+#include "warp_kernel.h"
+
+#if defined(__SSE4_1__)
+
+#include <smmintrin.h>
+
+namespace {
+
+struct VecSSE4
+{
+    enum { N = 4 };
+    typedef __m128 vf;
+    typedef __m128i vi;
+    typedef __m128 vm;
+
+    static vf set1(float a) { return _mm_set1_ps(a); }
+    static vi set1i(int32_t a) { return _mm_set1_epi32(a); }
+
+    static void loadST(const float *st, vf &s, vf &t)
+    {
+        __m128 a = _mm_loadu_ps(st);     // s0 t0 s1 t1
+        __m128 b = _mm_loadu_ps(st + 4); // s2 t2 s3 t3
+        s = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+        t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+    }
+    static vi load(const uint32_t *p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(uint32_t *p, vi a) { _mm_storeu_si128((__m128i*)p, a); }
+
+    static vf add(vf a, vf b) { return _mm_add_ps(a, b); }
+    static vf sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+    static vf mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+    static vf fmadd(vf a, vf b, vf c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static vf floor(vf a) { return _mm_floor_ps(a); }
+
+    static vi cvtt(vf a) { return _mm_cvttps_epi32(a); }
+    static vf cvt(vi a) { return _mm_cvtepi32_ps(a); }
+    static vf castf(vi a) { return _mm_castsi128_ps(a); }
+    static vi casti(vf a) { return _mm_castps_si128(a); }
+
+    static vi addi(vi a, vi b) { return _mm_add_epi32(a, b); }
+    static vi mullo(vi a, vi b) { return _mm_mullo_epi32(a, b); }
+    static vi clamp(vi a, vi lo, vi hi) { return _mm_min_epi32(_mm_max_epi32(a, lo), hi); }
+    static vi andi(vi a, vi b) { return _mm_and_si128(a, b); }
+    static vi ori(vi a, vi b) { return _mm_or_si128(a, b); }
+    template<int n> static vi srli(vi a) { return _mm_srli_epi32(a, n); }
+    template<int n> static vi slli(vi a) { return _mm_slli_epi32(a, n); }
+    static vi sll(vi a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+
+    // no gather instruction before AVX2
+    static vi gather(const uint32_t *base, vi idx)
+    {
+        return _mm_setr_epi32(base[_mm_extract_epi32(idx, 0)], base[_mm_extract_epi32(idx, 1)],
+                              base[_mm_extract_epi32(idx, 2)], base[_mm_extract_epi32(idx, 3)]);
+    }
+
+    static vm invalid(vf s, vf t, vf sentinel)
+    {
+        return _mm_or_ps(_mm_cmpeq_ps(s, sentinel), _mm_cmpeq_ps(t, sentinel));
+    }
+    static vi select(vm m, vi a, vi b)
+    {
+        return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(b), _mm_castsi128_ps(a), m));
+    }
+};
+
+} // namespace
+
+void warpSpan_sse4(const void *st, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpSpanAny<VecSSE4>(st, gain, out, n, k);
+}
+
+void warpLUT_sse4(const uint32_t *src, const uint32_t *entry, const uint32_t *weight, const uint32_t *gain, uint32_t *out, size_t n, const WarpKernelArgs &k)
+{
+    warpLUTAny<VecSSE4>(src, entry, weight, gain, out, n, k);
+}
+
+void packSpan_sse4(const uint32_t *const *sub, size_t planes, size_t offset, uint32_t *out, size_t n, const PackDither *dither)
+{
+    packSpanAny<VecSSE4>(sub, planes, offset, out, n, dither);
+}
+
+#endif
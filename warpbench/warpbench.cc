@@ -0,0 +1,466 @@
+// warpbench is to benchmark the CPU warp engines of curve2dmap
+// 4/15/2016 by Yang Yu (yuy@janelia.hhmi.org)
+//
+// usage: warpbench [deform.bin] [frames] [output.png]
+//
+
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+using namespace std;
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "deform.h"
+#include "warp.h"
+#include "bitplane.h"
+
+// input
+const size_t dimx = 1440;
+const size_t dimy = 360;
+
+// output, taken from the deformation header if it has one
+size_t width = 608;
+size_t height = 684;
+
+// test panorama: gradients under a checkerboard, so bilinear errors show up
+static void makePanorama(uint32_t *p, size_t w, size_t h)
+{
+    for(size_t y=0; y<h; y++)
+    {
+        for(size_t x=0; x<w; x++)
+        {
+            uint32_t r = (uint32_t)(255*x/(w-1));
+            uint32_t g = (uint32_t)(255*y/(h-1));
+            uint32_t b = ((x/16 + y/16) & 1) ? 255 : 0;
+            p[y*w+x] = r | (g<<8) | (b<<16) | 0xff000000;
+        }
+    }
+}
+
+// seconds per frame
+static double timeWarp(Warp *warp, const uint32_t *src, uint32_t *dst, int frames)
+{
+    warp->run(src, dst); // warm up
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for(int i=0; i<frames; i++)
+        warp->run(src, dst);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+    return chrono::duration<double>(t1 - t0).count() / frames;
+}
+
+static double timePool(WarpPool *pool, const uint32_t *src, uint32_t *dst, int frames)
+{
+    pool->run(src, dst);
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for(int i=0; i<frames; i++)
+        pool->run(src, dst);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+    return chrono::duration<double>(t1 - t0).count() / frames;
+}
+
+// largest per-channel difference to the reference output
+static int maxDiff(const uint32_t *a, const uint32_t *b, size_t n)
+{
+    int diff = 0;
+    for(size_t i=0; i<n; i++)
+    {
+        for(int c=0; c<4; c++)
+        {
+            int d = abs((int)((a[i] >> (8*c)) & 0xff) - (int)((b[i] >> (8*c)) & 0xff));
+            if(d > diff)
+                diff = d;
+        }
+    }
+    return diff;
+}
+
+// time an engine and check it against the reference
+static int bench(Warp *warp, const DeformMap &deform, const uint32_t *src, const uint32_t *ref, int frames)
+{
+    if(warp->init(deform, dimx, dimy))
+        return -1;
+
+    vector<uint32_t> dst(width*height);
+    double t = timeWarp(warp, src, &dst[0], frames);
+
+    printf("%-12s %8.3f ms/frame %8.1f Mpixels/s  max diff %d\n", warp->name(), 1e3*t,
+           width*height/t/1e6, maxDiff(ref, &dst[0], width*height));
+
+    return 0;
+}
+
+// thread scaling of one engine
+static int scaling(Warp *warp, const DeformMap &deform, const uint32_t *src, const uint32_t *ref, int frames)
+{
+    if(warp->init(deform, dimx, dimy))
+        return -1;
+
+    vector<uint32_t> dst(width*height);
+    size_t cores = thread::hardware_concurrency();
+    double t1 = 0;
+
+    for(size_t n=1; n<=cores; n++)
+    {
+        WarpPool pool;
+        if(pool.start(warp, n))
+            return -1;
+
+        double t = timePool(&pool, src, &dst[0], frames);
+        if(n == 1)
+            t1 = t;
+
+        printf("%-8s x%-3zu %8.3f ms/frame %8.1f Mpixels/s  speedup %5.2f  max diff %d\n", warp->name(), n,
+               1e3*t, width*height/t/1e6, t1/t, maxDiff(ref, &dst[0], width*height));
+    }
+
+    return 0;
+}
+
+// the SIMD builds on a compact encoding, checked against the reference on
+// the same encoding; the float map's output shows what the encoding costs
+static int benchEncoding(uint32_t type, const DeformMap &deform, const uint32_t *src, const uint32_t *ref, int frames)
+{
+    DeformMap encoded;
+    if(convertDeform(encoded, deform, type, dimx, dimy))
+        return -1;
+
+    vector<uint32_t> encRef(width*height);
+    WarpReference warp;
+    if(warp.init(encoded, dimx, dimy))
+        return -1;
+    warp.run(src, &encRef[0]);
+
+    printf("%-12s %.2f MB map, max diff %d to the float map\n", deformTypeName(type),
+           encoded.size()/1048576.0, maxDiff(ref, &encRef[0], width*height));
+
+    const char *isas[] = {"scalar", "sse4", "avx2", "avx512"};
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+    {
+        if(!WarpSIMD::supported(isas[i]))
+            continue;
+
+        WarpSIMD simd(isas[i]);
+        if(bench(&simd, encoded, src, &encRef[0], frames))
+            return -1;
+    }
+
+    return 0;
+}
+
+// every engine around the cylinder on a padded panorama, with the map
+// turned by shift columns so that it crosses the seam; checked against the
+// wrapping reference, the clamping one shows what the seam used to cost
+static int benchWrap(float shift, const DeformMap &deform, const uint32_t *src, int frames)
+{
+    DeformMap turned;
+    if(convertDeform(turned, deform, DEFORM_RG32F, dimx, dimy))
+        return -1;
+
+    for(size_t i=0; i<width*height; i++)
+        if(turned.p[2*i]!=turned.sentinel && turned.p[2*i+1]!=turned.sentinel)
+            turned.p[2*i] = fmodf(turned.p[2*i] + shift, (float)dimx);
+
+    vector<uint32_t> padded((dimx + 2)*dimy);
+    padPanorama(src, dimx, dimy, &padded[0]);
+
+    vector<uint32_t> ref(width*height), clamped(width*height);
+    WarpReference warp, clamp;
+    warp.wrap = true;
+    if(warp.init(turned, dimx, dimy) || clamp.init(turned, dimx, dimy))
+        return -1;
+    warp.run(&padded[0], &ref[0]);
+    clamp.run(src, &clamped[0]);
+
+    printf("wrap %-7.0f max diff %d clamped at the seam\n", shift, maxDiff(&ref[0], &clamped[0], width*height));
+
+    vector<Warp*> engines;
+    engines.push_back(new WarpSIMD);
+    engines.push_back(new WarpLUT(7));
+    engines.push_back(new WarpLUT(16));
+
+    int ret = 0;
+    for(size_t i=0; i<engines.size(); i++)
+    {
+        engines[i]->wrap = true;
+        if(ret == 0 && bench(engines[i], turned, &padded[0], &ref[0], frames))
+            ret = -1;
+        delete engines[i];
+    }
+
+    return ret;
+}
+
+// the engines with gains fused into the warp: brighter toward the edges,
+// as a curved screen needs, and a black level; checked against the
+// reference with the same gains
+static int benchPhotometric(const DeformMap &deform, const uint32_t *src, int frames)
+{
+    DeformMap corrected;
+    if(convertDeform(corrected, deform, deform.type, dimx, dimy))
+        return -1;
+
+    vector<uint32_t> gain(width*height);
+    for(size_t y=0; y<height; y++)
+    {
+        for(size_t x=0; x<width; x++)
+        {
+            float dx = (x - 0.5f*width)/(0.5f*width), dy = (y - 0.5f*height)/(0.5f*height);
+            float g = 0.55f + 0.45f*sqrtf(dx*dx + dy*dy);
+            gain[y*width+x] = packGain(g, 0.02f);
+        }
+    }
+    if(setDeformGain(corrected, &gain[0], 2.2f))
+        return -1;
+
+    vector<uint32_t> ref(width*height);
+    WarpReference warp;
+    if(warp.init(corrected, dimx, dimy))
+        return -1;
+    warp.run(src, &ref[0]);
+
+    printf("photometric  gamma %.1f, %.2f MB gains\n", corrected.gamma, 4.0*width*height/1048576.0);
+
+    vector<Warp*> engines;
+    engines.push_back(new WarpSIMD);
+    engines.push_back(new WarpLUT(7));
+
+    int ret = 0;
+    for(size_t i=0; i<engines.size(); i++)
+    {
+        if(ret == 0 && bench(engines[i], corrected, src, &ref[0], frames))
+            ret = -1;
+        delete engines[i];
+    }
+
+    return ret;
+}
+
+// how far the first plane strays from its subframe on average over 8x8
+// blocks, in 8-bit steps: what banding looks like from a distance
+static double localError(const uint32_t *sub, const uint32_t *packed, size_t bits)
+{
+    const size_t b = 8;
+    uint32_t levels = (1u << bits) - 1;
+    double error = 0.0;
+    size_t blocks = 0;
+
+    for(size_t by=0; by+b<=height; by+=b)
+    {
+        for(size_t bx=0; bx+b<=width; bx+=b)
+        {
+            double a = 0.0, q = 0.0;
+            for(size_t y=by; y<by+b; y++)
+            {
+                for(size_t x=bx; x<bx+b; x++)
+                {
+                    a += sub[y*width+x] & 0xff;
+                    q += (packed[y*width+x] & levels)*255.0/levels;
+                }
+            }
+            error += fabs(a - q)/(b*b);
+            blocks++;
+        }
+    }
+    return error/blocks;
+}
+
+// the packed frame by the definitions in bitplane.h and dither.h, in 64 bits
+static void packReference(const uint32_t *const *sub, size_t planes, const Dither &dither, uint32_t *dst)
+{
+    const size_t bits = 24 / planes;
+    const uint64_t levels = (1u << bits) - 1;
+
+    for(size_t y=0; y<height; y++)
+    {
+        for(size_t x=0; x<width; x++)
+        {
+            uint32_t word = 0xff000000;
+            for(size_t i=0; i<planes; i++)
+            {
+                uint64_t v = sub[i][y*width+x] & 0xff, q;
+                if(dither.type == DITHER_NONE)
+                {
+                    // round(v*levels/255)
+                    q = (2*v*levels + 255) / 510;
+                }
+                else
+                {
+                    // floor(v*levels/255 + (T + 0.5)/256)
+                    size_t m = dither.size - 1;
+                    uint64_t T = dither.threshold[((y + 7*i) & m)*dither.stride + ((x + 13*i) & m)];
+                    q = (512*v*levels + 255*(2*T + 1)) / (255*512);
+                }
+                word |= (uint32_t)q << (i*bits);
+            }
+            dst[y*width+x] = word;
+        }
+    }
+}
+
+// packing of warped subframes into bit planes, checked against the reference
+static int benchPack(size_t planes, uint32_t dither, const DeformMap &deform, const uint32_t *src, int frames)
+{
+    // subframes of a moving panorama
+    vector< vector<uint32_t> > sub(planes, vector<uint32_t>(width*height));
+    vector<const uint32_t*> subframes(planes);
+    vector<uint32_t> shifted(dimx*dimy);
+
+    WarpSIMD warp;
+    if(warp.init(deform, dimx, dimy))
+        return -1;
+
+    for(size_t i=0; i<planes; i++)
+    {
+        size_t dx = i*dimx/planes;
+        for(size_t y=0; y<dimy; y++)
+            for(size_t x=0; x<dimx; x++)
+                shifted[y*dimx+x] = src[y*dimx + (x+dx)%dimx];
+
+        warp.run(&shifted[0], &sub[i][0]);
+        subframes[i] = &sub[i][0];
+    }
+
+    vector<uint32_t> ref(width*height), dst(width*height);
+
+    Dither tile;
+    if(tile.init(dither))
+        return -1;
+    packReference(&subframes[0], planes, tile, &ref[0]);
+
+    const char *isas[] = {"scalar", "sse4", "avx2", "avx512"};
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+    {
+        if(!WarpSIMD::supported(isas[i]))
+            continue;
+
+        Bitplanes pack(isas[i]);
+        if(pack.init(planes, width, height, dither))
+            return -1;
+
+        pack.run(&subframes[0], &dst[0]);
+
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for(int k=0; k<frames; k++)
+            pack.run(&subframes[0], &dst[0]);
+        double t = chrono::duration<double>(chrono::steady_clock::now() - t0).count() / frames;
+
+        printf("pack %2zux%-2zu %-5s %-7s %8.3f ms/frame %8.1f Mpixels/s  %s, local error %.2f\n", planes, pack.bits,
+               Dither::name(dither), isas[i], 1e3*t, width*height/t/1e6,
+               memcmp(&ref[0], &dst[0], 4*width*height) ? "MISMATCH" : "exact", localError(subframes[0], &dst[0], pack.bits));
+    }
+
+    return 0;
+}
+
+//
+// main func
+//
+int main(int argc, char *argv[])
+{
+    string deformFile = "../transformation/deform.bin";
+    int frames = 100;
+    const char *outFile = NULL;
+
+    if(argc>1)
+        deformFile = argv[1];
+    if(argc>2)
+        frames = atoi(argv[2]);
+    if(argc>3)
+        outFile = argv[3];
+
+    DeformMap deform;
+    if(loadDeform(deform, deformFile, width, height))
+        return -1;
+    width = deform.width;
+    height = deform.height;
+
+    size_t nvalid = 0;
+    for(size_t y=0; y<height; y++)
+        for(size_t x=0; x<width; x++)
+            nvalid += deform.valid(x, y);
+
+    std::cout<<"deformation "<<width<<"x"<<height<<", "<<nvalid<<" valid pixels ("
+             <<100.0*nvalid/(width*height)<<"%)"<<std::endl;
+
+    vector<uint32_t> src(dimx*dimy), ref(width*height);
+    makePanorama(&src[0], dimx, dimy);
+
+    WarpReference warp;
+    if(warp.init(deform, dimx, dimy))
+        return -1;
+
+    double t = timeWarp(&warp, &src[0], &ref[0], frames);
+    printf("%-12s %8.3f ms/frame %8.1f Mpixels/s\n", warp.name(), 1e3*t, width*height/t/1e6);
+
+    const char *isas[] = {"scalar", "sse4", "avx2", "avx512"};
+    for(size_t i=0; i<sizeof(isas)/sizeof(isas[0]); i++)
+    {
+        if(!WarpSIMD::supported(isas[i]))
+        {
+            printf("%-12s not supported\n", isas[i]);
+            continue;
+        }
+
+        WarpSIMD simd(isas[i]);
+        bench(&simd, deform, &src[0], &ref[0], frames);
+    }
+
+    int bits[] = {7, 16};
+    for(size_t i=0; i<sizeof(bits)/sizeof(bits[0]); i++)
+    {
+        WarpLUT lut(bits[i]);
+        if(bench(&lut, deform, &src[0], &ref[0], frames))
+            return -1;
+        printf("%-12s %8.2f MB table, float map %.2f MB\n", "", lut.size()/1048576.0,
+               2*sizeof(float)*width*height/1048576.0);
+    }
+
+    uint32_t types[] = {DEFORM_RG16F, DEFORM_RG16};
+    for(size_t i=0; i<sizeof(types)/sizeof(types[0]); i++)
+        if(benchEncoding(types[i], deform, &src[0], &ref[0], frames))
+            return -1;
+
+    if(benchWrap(dimx - 570.0f, deform, &src[0], frames))
+        return -1;
+
+    if(benchPhotometric(deform, &src[0], frames))
+        return -1;
+
+    WarpSIMD best;
+    if(scaling(&best, deform, &src[0], &ref[0], frames))
+        return -1;
+
+    WarpLUT lut;
+    if(scaling(&lut, deform, &src[0], &ref[0], frames))
+        return -1;
+
+    size_t planes[] = {24, 8, 3, 2, 1};
+    uint32_t dithers[] = {DITHER_NONE, DITHER_BAYER, DITHER_BLUE};
+    for(size_t i=0; i<sizeof(planes)/sizeof(planes[0]); i++)
+        for(size_t j=0; j<sizeof(dithers)/sizeof(dithers[0]); j++)
+            if(benchPack(planes[i], dithers[j], deform, &src[0], frames))
+                return -1;
+
+    if(outFile)
+    {
+        if(!stbi_write_png(outFile, width, height, 4, &ref[0], width*4))
+        {
+            std::cout<<"Fail to write "<<outFile<<std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}